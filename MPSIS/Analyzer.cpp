@@ -0,0 +1,314 @@
+#include "Analyzer.h"
+#include <algorithm>
+#include <fstream>
+
+using namespace std;
+
+// UNBOUNDED comes from a loop without a bound, OVERFLOW from bounded counts past 64 bits
+const uint64_t UNBOUNDED = ~0ull;
+const uint64_t OVERFLOW = UNBOUNDED - 1;
+
+static uint64_t sat_add(uint64_t a, uint64_t b) {
+	if (a == UNBOUNDED || b == UNBOUNDED) return UNBOUNDED;
+	return a >= OVERFLOW - b ? OVERFLOW : a + b;
+}
+static uint64_t sat_mul(uint64_t a, uint64_t b) {
+	if (a == 0 || b == 0) return 0;
+	if (a == UNBOUNDED || b == UNBOUNDED) return UNBOUNDED;
+	return a >= OVERFLOW / b ? OVERFLOW : a * b;
+}
+
+static void print_cycles(ostream& os, uint64_t cycles) {
+	if (cycles == UNBOUNDED) os << "unbounded";
+	else if (cycles == OVERFLOW) os << "overflow";
+	else os << cycles;
+}
+
+// Every word is one cycle in this machine model, jumps included
+uint64_t word_cycles(uint32_t) {
+	return 1;
+}
+
+void read_source_lines(const char* source, map<int, string>& text) {
+	if (text.empty()) return;
+	ifstream fin(source, ifstream::binary);
+	string line;
+	for (int line_no = 1; getline(fin, line) && line_no <= text.rbegin()->first; line_no++) {
+		auto it = text.find(line_no);
+		if (it == text.end()) continue;
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		it->second = line;
+	}
+}
+
+class loop {
+public:
+	int head = 0;
+	int tail = 0;		// back-edge jump word
+	int parent = -1;
+	int outside = -1;	// innermost ancestor with another header
+	bool bounded = false;
+	uint64_t bound = 0;
+	uint64_t body = 0;	// worst cycles of one iteration, 0 if tail can't be reached
+};
+
+// Loops sharing a header nest, first is the outermost
+class loop_group {
+public:
+	int head;
+	int first;
+	int last;
+};
+
+class analysis {
+public:
+	const vector<uint32_t>& words;
+	const vector<int>& targets;
+	int size;
+
+	vector<uint64_t> cost;			// worst cycles of word, loop iterations are charged to the header
+	vector<loop> loops;				// by header, outermost first
+	vector<loop_group> groups;		// by header
+	vector<uint64_t> dist;
+	vector<int> pred;
+	vector<char> seen;
+
+	analysis(const vector<uint32_t>& w, const vector<int>& t) : words(w), targets(t), size((int)w.size()) {}
+
+	bool falls(int i) const { return (words[i] >> 22) != 7; }
+	int taken(int i) const { return (words[i] >> 22) ? targets[i] : -1; }
+
+	// Longest paths head -> end over forward edges without the head's own cost, relative to head
+	void sweep(int head, int end) {
+		int length = end - head + 1;
+		dist.assign(length, 0);
+		pred.assign(length, -1);
+		seen.assign(length, 0);
+		seen[0] = 1;
+
+		for (int k = head; k < end; k++) {
+			if (!seen[k - head]) continue;
+			uint64_t d = dist[k - head];
+
+			int next[2] = { falls(k) ? k + 1 : -1, taken(k) };
+			for (int s : next) {
+				if (s <= k || s > end) continue;
+				uint64_t through = sat_add(d, cost[s]);
+				if (!seen[s - head] || through > dist[s - head]) {
+					dist[s - head] = through;
+					pred[s - head] = k;
+					seen[s - head] = 1;
+				}
+			}
+		}
+	}
+
+	// Headers from the last one back, so every header inside a group is final before its sweep
+	// A group's loops fold innermost first: each iteration of a loop runs the loops inside it at the same header
+	void fold_loops() {
+		for (auto g = groups.rbegin(); g != groups.rend(); ++g) {
+			sweep(g->head, loops[g->first].tail);
+			uint64_t header = cost[g->head];
+			for (int id = g->last - 1; id >= g->first; id--) {
+				loop& lp = loops[id];
+				lp.body = seen[lp.tail - g->head] ? sat_add(header, dist[lp.tail - g->head]) : 0;
+				if (lp.body == 0) continue;
+				header = lp.bounded ? sat_add(header, sat_mul(lp.bound, lp.body)) : UNBOUNDED;
+			}
+			cost[g->head] = header;
+		}
+	}
+
+	// Executions of every word on the slowest path, visits start as the path itself
+	// Headers from the first one on: a group turns the visits of its header into visits along each loop body
+	void count_visits(vector<uint64_t>& visits) {
+		vector<uint64_t> along;
+		for (const loop_group& g : groups) {
+			uint64_t m = visits[g.head];
+			if (m == 0) continue;
+
+			sweep(g.head, loops[g.first].tail);
+			along.assign(dist.size(), 0);
+			for (int id = g.first; id < g.last; id++) {
+				const loop& lp = loops[id];
+				if (!lp.bounded || lp.body == 0) continue;
+				uint64_t iterations = sat_mul(m, lp.bound);
+				along[lp.tail - g.head] = sat_add(along[lp.tail - g.head], iterations);
+				m = sat_add(m, iterations);
+			}
+			visits[g.head] = m;
+
+			// a body path is the pred chain from its tail, counts run down the chains in one pass
+			for (int k = (int)along.size() - 1; k > 0; k--) {
+				if (along[k] == 0) continue;
+				visits[g.head + k] = sat_add(visits[g.head + k], along[k]);
+				int p = pred[k] - g.head;
+				if (p > 0) along[p] = sat_add(along[p], along[k]);
+			}
+		}
+	}
+};
+
+void wcet_report(const vector<uint32_t>& words, const vector<int>& targets, const vector<int>& source_lines,
+	const map<string, int>& labels, const map<int, int>& bounds, const char* source, ostream& os) {
+	analysis a(words, targets);
+	int n = a.size;
+
+	a.cost.resize(n);
+	for (int i = 0; i < n; i++) a.cost[i] = word_cycles(words[i]);
+
+	// back-edges make loops, they have to nest and be entered through the header
+	for (int i = 0; i < n; i++) {
+		int t = a.taken(i);
+		if (t < 0 || t > i) continue;
+
+		loop lp;
+		lp.head = t;
+		lp.tail = i;
+		auto it = bounds.find(i);
+		if (it != bounds.end()) {
+			lp.bounded = true;
+			lp.bound = (uint64_t)it->second;
+		}
+		a.loops.push_back(lp);
+	}
+	sort(a.loops.begin(), a.loops.end(), [](const loop& x, const loop& y) {
+		return x.head != y.head ? x.head < y.head : x.tail > y.tail;
+	});
+
+	// the loop forest in one stack pass, loops sharing a header form a group
+	vector<int> stack;
+	for (int id = 0; id < (int)a.loops.size(); id++) {
+		loop& lp = a.loops[id];
+		while (!stack.empty() && a.loops[stack.back()].tail < lp.head) stack.pop_back();
+		if (!stack.empty()) {
+			loop& outer = a.loops[stack.back()];
+			if (outer.tail < lp.tail) {
+				os << "Line " << source_lines[lp.tail] << ": loop overlaps loop of line " << source_lines[outer.tail] << endl;
+				lp.bounded = outer.bounded = false;
+			}
+			lp.parent = stack.back();
+			lp.outside = outer.head == lp.head ? outer.outside : lp.parent;
+		}
+		stack.push_back(id);
+
+		if (a.groups.empty() || a.groups.back().head != lp.head) a.groups.push_back({ lp.head, id, id });
+		a.groups.back().last = id + 1;
+	}
+
+	// innermost loop around every word
+	vector<int> inner(n, -1);
+	stack.clear();
+	for (int k = 0, id = 0; k < n; k++) {
+		while (id < (int)a.loops.size() && a.loops[id].head == k) stack.push_back(id++);
+		while (!stack.empty() && a.loops[stack.back()].tail < k) stack.pop_back();
+		if (!stack.empty()) inner[k] = stack.back();
+	}
+	for (int i = 0; i < n; i++) {
+		int t = a.taken(i);
+		if (t <= i) continue;
+		for (int id = inner[t]; id != -1 && i < a.loops[id].head;) {
+			if (t == a.loops[id].head) {
+				id = a.loops[id].outside;
+				continue;
+			}
+			os << "Line " << source_lines[i] << ": jump into loop of line " << source_lines[a.loops[id].tail] << endl;
+			a.loops[id].bounded = false;
+			id = a.loops[id].parent;
+		}
+	}
+
+	a.fold_loops();
+
+	// cycles from every word to the end of the program, loops taken zero times in the best case
+	vector<uint64_t> worst(n + 1, 0), best(n + 1, 0);
+	vector<int> next(n + 1, -1);
+	vector<char> reach(n + 1, 0);
+	reach[n] = 1;
+	for (int i = n - 1; i >= 0; i--) {
+		int succ[2] = { a.falls(i) ? i + 1 : -1, a.taken(i) };
+		for (int s : succ) {
+			if (s <= i || !reach[s]) continue;
+			uint64_t w = sat_add(a.cost[i], worst[s]);
+			uint64_t b = word_cycles(words[i]) + best[s];
+			if (!reach[i] || w > worst[i]) {
+				worst[i] = w;
+				next[i] = s;
+			}
+			if (!reach[i] || b < best[i]) best[i] = b;
+			reach[i] = 1;
+		}
+	}
+
+	os << "Program: best ";
+	if (reach[0]) {
+		print_cycles(os, best[0]);
+		os << ", worst ";
+		print_cycles(os, worst[0]);
+		os << " cycles" << endl;
+	}
+	else os << "never ends" << endl;
+
+	vector<pair<int, string>> by_pos;
+	for (auto const& kvp : labels) by_pos.push_back(make_pair(kvp.second - 1, kvp.first));
+	sort(by_pos.begin(), by_pos.end());
+
+	os << endl << "Labels (cycles to the end):" << endl;
+	for (auto const& lbl : by_pos) {
+		int pos = lbl.first;
+		os << "  " << lbl.second << " (line " << source_lines[pos] << "): ";
+		if (!reach[pos]) {
+			os << "never ends" << endl;
+			continue;
+		}
+		os << "best ";
+		print_cycles(os, best[pos]);
+		os << ", worst ";
+		print_cycles(os, worst[pos]);
+		os << endl;
+	}
+
+	if (!a.loops.empty()) {
+		os << endl << "Loops:" << endl;
+		for (const loop& lp : a.loops) {
+			os << "  line " << source_lines[lp.tail] << " -> line " << source_lines[lp.head] << ": ";
+			if (lp.bounded) os << "bound " << lp.bound;
+			else os << "unbounded";
+			os << ", iteration ";
+			print_cycles(os, lp.body);
+			os << " cycles" << endl;
+		}
+	}
+
+	if (!reach[0] || n == 0) return;
+
+	int max_line = 0;
+	for (int line : source_lines) max_line = max(max_line, line);
+	vector<uint64_t> visits(n, 0);
+	for (int k = 0; k < n; k = next[k]) visits[k] = 1;
+	a.count_visits(visits);
+
+	vector<uint64_t> contrib(max_line + 1, 0);
+	for (int k = 0; k < n; k++) contrib[source_lines[k]] = sat_add(contrib[source_lines[k]], sat_mul(visits[k], word_cycles(words[k])));
+
+	vector<pair<uint64_t, int>> top;
+	for (int line = 0; line <= max_line; line++) {
+		if (contrib[line] != 0) top.push_back(make_pair(contrib[line], line));
+	}
+	sort(top.begin(), top.end(), [](const pair<uint64_t, int>& x, const pair<uint64_t, int>& y) {
+		return x.first != y.first ? x.first > y.first : x.second < y.second;
+	});
+	if (top.size() > 10) top.resize(10);
+
+	map<int, string> text;
+	for (auto const& t : top) text[t.second] = "";
+	read_source_lines(source, text);
+
+	os << endl << "Slowest path by source line:" << endl;
+	for (auto const& t : top) {
+		os << "  line " << t.second << ": ";
+		print_cycles(os, t.first);
+		if (worst[0] < OVERFLOW && t.first < OVERFLOW) os << " cycles (" << t.first * 100 / worst[0] << "%)";
+		os << "  " << text[t.second] << endl;
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Cycles taken by one word
+uint64_t word_cycles(uint32_t word);
+
+// Fills text with the lines of source whose numbers are its keys
+void read_source_lines(const char* source, std::map<int, std::string>& text);
+
+// Static best/worst case cycles of the program and of every label
+// targets[i] is the destination of jump word i or -1, bounds are loop bounds keyed by back-edge position
+void wcet_report(const std::vector<uint32_t>& words, const std::vector<int>& targets, const std::vector<int>& source_lines,
+	const std::map<std::string, int>& labels, const std::map<int, int>& bounds, const char* source, std::ostream& os);
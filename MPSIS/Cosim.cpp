@@ -0,0 +1,256 @@
+#include "Cosim.h"
+#include "Loader.h"
+#include "Queue.h"
+#include "Simulator.h"
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+class message {
+public:
+	uint64_t cycle;
+	uint8_t value;
+};
+
+// Every quantum fills at most quantum items and the receiver empties the previous one meanwhile
+typedef spsc_queue<message, 2 * COSIM_QUANTUM_MAX + 1> channel;
+
+class node {
+public:
+	string name;
+	vector<uint32_t> program;
+	machine m;
+	vector<channel*> outs[4];
+	vector<channel*> ins;
+	vector<message> pending;
+	vector<char> has_pending;
+	bool halted = false;
+
+	// Puts the latest value that is due into DataIn, returns the cycle the next one is due
+	uint64_t apply_inputs(uint32_t quantum) {
+		uint64_t latest = 0;
+		bool found = false;
+		uint64_t next = UINT64_MAX;
+
+		for (size_t i = 0; i < ins.size(); i++) {
+			while (has_pending[i] || ins[i]->pop(pending[i])) {
+				has_pending[i] = 1;
+				message& msg = pending[i];
+				if (msg.cycle + quantum > m.cycles) {
+					next = min(next, msg.cycle + quantum);
+					break;
+				}
+				if (!found || msg.cycle >= latest) {
+					latest = msg.cycle;
+					m.in = msg.value;
+					found = true;
+				}
+				has_pending[i] = 0;
+			}
+		}
+		return next;
+	}
+
+	void run_quantum(uint64_t end, uint32_t quantum) {
+		uint64_t next_input = apply_inputs(quantum);
+		const uint32_t* words = program.data();
+		size_t size = program.size();
+
+		while (m.cycles < end) {
+			if (m.pc >= size) {
+				halted = true;
+				return;
+			}
+			if (m.cycles >= next_input) next_input = apply_inputs(quantum);
+
+			uint32_t word = words[m.pc];
+			sim_step(m, word);
+			if (word & 0x800) {
+				for (channel* c : outs[word & 3]) {
+					message msg = { m.cycles - 1, m.out[word & 3] };
+					c->push(msg);
+				}
+			}
+		}
+	}
+};
+
+// Work stealing pool, every worker takes jobs from the back of its queue and steals from the front of others
+class steal_pool {
+public:
+	explicit steal_pool(unsigned count) {
+		for (unsigned i = 0; i < count; i++) queues.push_back(unique_ptr<job_queue>(new job_queue()));
+		for (unsigned i = 1; i < count; i++) threads.push_back(thread(&steal_pool::work, this, i));
+	}
+
+	~steal_pool() {
+		stop = true;
+		for (thread& t : threads) t.join();
+	}
+
+	// Runs job(i) for every i < count, the calling thread works too
+	void run(size_t count, const function<void(size_t)>& f) {
+		job = &f;
+		remaining = count;
+		for (size_t i = 0; i < count; i++) {
+			job_queue& q = *queues[i % queues.size()];
+			lock_guard<mutex> guard(q.lock);
+			q.jobs.push_back(i);
+		}
+		generation++;
+
+		size_t index;
+		while (next(0, index)) {
+			f(index);
+			remaining--;
+		}
+		while (remaining.load() != 0) this_thread::yield();
+	}
+
+private:
+	class job_queue {
+	public:
+		mutex lock;
+		deque<size_t> jobs;
+	};
+
+	vector<unique_ptr<job_queue>> queues;
+	vector<thread> threads;
+	const function<void(size_t)>* job = nullptr;
+	atomic<size_t> remaining{ 0 };
+	atomic<uint64_t> generation{ 0 };
+	atomic<bool> stop{ false };
+
+	bool next(unsigned id, size_t& index) {
+		{
+			job_queue& own = *queues[id];
+			lock_guard<mutex> guard(own.lock);
+			if (!own.jobs.empty()) {
+				index = own.jobs.back();
+				own.jobs.pop_back();
+				return true;
+			}
+		}
+		for (size_t k = 1; k < queues.size(); k++) {
+			job_queue& victim = *queues[(id + k) % queues.size()];
+			lock_guard<mutex> guard(victim.lock);
+			if (!victim.jobs.empty()) {
+				index = victim.jobs.front();
+				victim.jobs.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(unsigned id) {
+		uint64_t seen = 0;
+		while (!stop) {
+			uint64_t current = generation.load();
+			if (current == seen) {
+				this_thread::yield();
+				continue;
+			}
+			seen = current;
+
+			size_t index;
+			while (next(id, index)) {
+				(*job)(index);
+				remaining--;
+			}
+		}
+	}
+};
+
+bool cosim_run(const char* path, uint64_t max_cycles, uint32_t quantum, ostream& os) {
+	if (quantum == 0 || quantum > COSIM_QUANTUM_MAX) {
+		os << "Quantum has to be 1.." << COSIM_QUANTUM_MAX << endl;
+		return false;
+	}
+
+	ifstream fin(path, ifstream::binary);
+	if (!fin.is_open()) {
+		os << "Can't open '" << path << "'" << endl;
+		return false;
+	}
+
+	vector<unique_ptr<node>> nodes;
+	vector<unique_ptr<channel>> channels;
+	map<string, node*> by_name;
+
+	string line;
+	for (int line_no = 1; getline(fin, line); line_no++) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		istringstream words(line);
+		string kind;
+		if (!(words >> kind)) continue;
+
+		if (kind == "node") {
+			unique_ptr<node> n(new node());
+			string file;
+			int in = 0;
+			if (!(words >> n->name >> file) || by_name.count(n->name)) {
+				os << "Line " << line_no << ": bad node" << endl;
+				return false;
+			}
+			if (words >> in) n->m.in = in & 15;
+			int status = load_program(file.c_str(), n->program);
+			if (status != 0) {
+				os << "Line " << line_no << ": can't load '" << file << "'" << endl;
+				return false;
+			}
+			by_name[n->name] = n.get();
+			nodes.push_back(move(n));
+		}
+		else if (kind == "link") {
+			string from, to;
+			int port;
+			if (!(words >> from >> port >> to) || !by_name.count(from) || !by_name.count(to) || port < 0 || port > 3) {
+				os << "Line " << line_no << ": bad link" << endl;
+				return false;
+			}
+			channels.push_back(unique_ptr<channel>(new channel()));
+			by_name[from]->outs[port].push_back(channels.back().get());
+			node* receiver = by_name[to];
+			receiver->ins.push_back(channels.back().get());
+			receiver->pending.push_back(message());
+			receiver->has_pending.push_back(0);
+		}
+		else {
+			os << "Line " << line_no << ": unknown '" << kind << "'" << endl;
+			return false;
+		}
+	}
+
+	auto started = chrono::steady_clock::now();
+	steal_pool pool(max(1u, thread::hardware_concurrency()));
+	vector<node*> live;
+
+	for (uint64_t start = 0; start < max_cycles; start += quantum) {
+		uint64_t end = min(start + quantum, max_cycles);
+		live.clear();
+		for (auto& n : nodes) if (!n->halted) live.push_back(n.get());
+		if (live.empty()) break;
+
+		pool.run(live.size(), [&](size_t i) { live[i]->run_quantum(end, quantum); });
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+	uint64_t total = 0;
+	for (auto& n : nodes) {
+		os << "[" << n->name << "]" << endl;
+		sim_print(n->m, os);
+		total += n->m.cycles;
+	}
+	os << nodes.size() << " nodes, " << total << " cycles in " << seconds << " s" << endl;
+
+	return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+
+/* NETWORK FILE
+
+node <name> <_file> [DataIn]
+link <from> <port> <to>		- out port of one node drives DataIn of another
+
+Every node runs quantum cycles at a time, all nodes meet at the quantum boundary
+A value strobed at cycle t reaches the receivers DataIn at cycle t + quantum, so results don't depend on scheduling
+
+*/
+
+const uint32_t COSIM_QUANTUM_MAX = 8192;
+
+// Runs every node for at most max_cycles, returns false on a bad network file
+bool cosim_run(const char* path, uint64_t max_cycles, uint32_t quantum, std::ostream& os);
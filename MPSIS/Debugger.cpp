@@ -0,0 +1,193 @@
+#include "Debugger.h"
+#include <cstring>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+debugger::debugger(const vector<uint32_t>& program, const machine& start, size_t budget) : m(start), program(program), budget(budget) {
+	history.push_back(history_segment());
+	history.back().start = start;
+	breaks.assign(program.size() + 1, 0);
+}
+
+bool debugger::step() {
+	if (m.pc >= program.size()) return false;
+
+	if (m.cycles - history.back().start.cycles >= DEBUG_CHECKPOINT) {
+		history.back().log.shrink_to_fit();
+		history.push_back(history_segment());
+		history.back().start = m;
+		while (log_bytes > budget && history.size() > 1) {
+			log_bytes -= history.front().log.size();
+			history.pop_front();
+		}
+	}
+
+	uint32_t word = program[m.pc];
+	uint32_t old_pc = m.pc;
+	uint8_t old_latches = (uint8_t)(m.ra << 4 | m.rb);
+	uint8_t old_rf = m.rf[word & 15];
+	uint8_t old_out = m.out[word & 3];
+	uint8_t old_flags = (uint8_t)(m.z << 5 | m.c << 6);
+	sim_step(m, word);
+
+	uint8_t record[8];
+	size_t n = 0;
+	uint8_t header = 0;
+	written = -1;
+	if ((uint8_t)(m.ra << 4 | m.rb) != old_latches) {
+		header |= 2;
+		record[n++] = old_latches;
+	}
+	if (word & 0x1000) {
+		header |= 4 | old_flags;
+		record[n++] = old_rf;
+		written = word & 15;
+		written_old = old_rf;
+	}
+	if (word & 0x800) {
+		header |= 8;
+		record[n++] = old_out;
+	}
+	if (m.pc != old_pc + 1) {
+		header |= 1;
+		memcpy(record + n, &old_pc, 4);
+		n += 4;
+	}
+	record[n++] = header;
+
+	vector<uint8_t>& log = history.back().log;
+	log.insert(log.end(), record, record + n);
+	log_bytes += n;
+	return true;
+}
+
+bool debugger::step_back() {
+	while (history.back().log.empty()) {
+		if (history.size() == 1) return false;
+		history.pop_back();
+	}
+
+	vector<uint8_t>& log = history.back().log;
+	size_t n = log.size();
+	uint8_t header = log[--n];
+	uint32_t old_pc = m.pc - 1;
+	if (header & 1) {
+		n -= 4;
+		memcpy(&old_pc, &log[n], 4);
+	}
+	uint32_t word = program[old_pc];
+
+	written = -1;
+	if (header & 8) m.out[word & 3] = log[--n];
+	if (header & 4) {
+		written = word & 15;
+		written_old = m.rf[written];
+		m.rf[written] = log[--n];
+		m.z = (header >> 5) & 1;
+		m.c = (header >> 6) & 1;
+	}
+	if (header & 2) {
+		uint8_t latches = log[--n];
+		m.ra = latches >> 4;
+		m.rb = latches & 15;
+	}
+
+	log_bytes -= log.size() - n;
+	log.resize(n);
+	m.pc = old_pc;
+	m.cycles--;
+	return true;
+}
+
+uint64_t debugger::run(uint64_t max_cycles) {
+	uint64_t done = 0;
+	while (done < max_cycles && step()) {
+		done++;
+		if (breaks[min((size_t)m.pc, breaks.size() - 1)]) break;
+		if (written >= 0 && ((watch >> written) & 1) && m.rf[written] != written_old) break;
+	}
+	return done;
+}
+
+uint64_t debugger::run_back(uint64_t max_cycles) {
+	uint64_t done = 0;
+	while (done < max_cycles && step_back()) {
+		done++;
+		if (breaks[m.pc]) break;
+		if (written >= 0 && ((watch >> written) & 1) && m.rf[written] != written_old) break;
+	}
+	return done;
+}
+
+bool debugger::seek(uint64_t cycle) {
+	if (cycle < oldest_cycle()) return false;
+
+	if (cycle < m.cycles) {
+		while (history.back().start.cycles > cycle) {
+			log_bytes -= history.back().log.size();
+			history.pop_back();
+		}
+		history_segment& segment = history.back();
+		log_bytes -= segment.log.size();
+		segment.log.clear();
+		m = segment.start;
+	}
+	while (m.cycles < cycle && step()) {}
+	return m.cycles == cycle;
+}
+
+void debugger::toggle_break(uint32_t pc) {
+	if (pc < program.size()) breaks[pc] ^= 1;
+}
+
+/* COMMANDS
+
+s [n]	- step n cycles
+rs [n]	- step n cycles back
+c [n]	- continue to a breakpoint, a watched register change or the end
+rc [n]	- the same backwards, stops before the change
+g cycle	- go to a cycle through the nearest checkpoint
+b pc	- toggle a breakpoint
+w reg	- toggle a register watch
+p		- print the state and the history kept
+q		- quit
+
+*/
+
+void debug_session(debugger& dbg, istream& is, ostream& os) {
+	string line;
+	while (getline(is, line)) {
+		istringstream words(line);
+		string name;
+		if (!(words >> name)) continue;
+		uint64_t arg = 0;
+		bool has_arg = (bool)(words >> arg);
+
+		if (name == "q") return;
+		if (name == "s") {
+			for (uint64_t i = has_arg ? arg : 1; i > 0 && dbg.step(); i--) {}
+		}
+		else if (name == "rs") {
+			for (uint64_t i = has_arg ? arg : 1; i > 0 && dbg.step_back(); i--) {}
+		}
+		else if (name == "c") dbg.run(has_arg ? arg : UINT64_MAX);
+		else if (name == "rc") dbg.run_back(has_arg ? arg : UINT64_MAX);
+		else if (name == "g" && has_arg) {
+			if (!dbg.seek(arg)) os << "Cycle " << arg << " is out of reach" << endl;
+		}
+		else if (name == "b" && has_arg) dbg.toggle_break((uint32_t)arg);
+		else if (name == "w" && has_arg) dbg.toggle_watch((uint32_t)arg);
+		else if (name == "p") {
+			sim_print(dbg.m, os);
+			os << "history: from cycle " << dbg.oldest_cycle() << ", " << dbg.history_bytes() << " bytes" << endl;
+			continue;
+		}
+		else {
+			os << "?" << endl;
+			continue;
+		}
+		os << "cycle " << dbg.m.cycles << " pc " << dbg.m.pc << endl;
+	}
+}
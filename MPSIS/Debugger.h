@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "Simulator.h"
+
+/* UNDO LOG - one record per cycle, read backwards
+
+[old latches 1b] [old rf 1b] [old out 1b] [old pc 4b] header 1b
+
+header:
+	bit 0 - pc didn't just advance by 1, old pc present
+	bit 1 - RA or RB changed, old RA << 4 | RB present
+	bit 2 - register written, old value present, old Z and C in bits 5 and 6
+	bit 3 - out written, old value present
+
+Register and port numbers come from the word at the old pc
+A full checkpoint starts a new segment every DEBUG_CHECKPOINT cycles, the oldest segments are dropped to stay in budget
+
+*/
+
+const uint64_t DEBUG_CHECKPOINT = 1 << 16;
+
+class history_segment {
+public:
+	machine start;
+	std::vector<uint8_t> log;
+};
+
+class debugger {
+public:
+	machine m;
+
+	debugger(const std::vector<uint32_t>& program, const machine& start, size_t budget);
+
+	// false at the end of the program or of the history
+	bool step();
+	bool step_back();
+
+	// Runs until a breakpoint or a watched register change, returns the cycles done
+	uint64_t run(uint64_t max_cycles);
+	uint64_t run_back(uint64_t max_cycles);
+
+	// Restores the nearest checkpoint and replays to the cycle, false if it's no longer in the history
+	bool seek(uint64_t cycle);
+
+	uint64_t oldest_cycle() const { return history.front().start.cycles; }
+	size_t history_bytes() const { return log_bytes; }
+
+	void toggle_break(uint32_t pc);
+	void toggle_watch(uint32_t reg) { watch ^= 1 << (reg & 15); }
+
+private:
+	const std::vector<uint32_t>& program;
+	std::deque<history_segment> history;
+	size_t budget;
+	size_t log_bytes = 0;
+	std::vector<char> breaks;
+	uint32_t watch = 0;
+
+	// Register written by the last step or undo, -1 if none
+	int written = -1;
+	uint8_t written_old = 0;
+};
+
+// Reads commands until q or the end of input
+void debug_session(debugger& dbg, std::istream& is, std::ostream& os);
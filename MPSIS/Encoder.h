@@ -0,0 +1,587 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/* INSTRUCTION ENCODER
+
+Shared by the command-line assembler and the compile-time one below, no allocation and no I/O
+One source line gives up to ENCODE_MAX_WORDS packed words (see Simulator.h for the layout)
+
+COMPILE-TIME USE:
+
+	constexpr auto& program = microprogram<R"(
+		mov !5 1
+		lbl loop
+		dec 1 1
+		jne loop
+	)">;
+
+program is a std::array<uint32_t, N> ready for sim_run, an assembly error stops the compilation
+in assembly_failed<line, reason>, the line counted from the one R"( is on
+Words separate on spaces or tabs and blank lines are skipped
+drop_reloads and the peephole table run in the command-line assembler only
+
+*/
+
+const size_t ENCODE_MAX_WORDS = 8;
+const size_t ENCODE_MAX_TOKENS = 8;
+const uint32_t JUMP_DEST_MAX = 255;		// jump destinations are 8 bits
+
+enum word_kind { WORD_PLAIN, WORD_JUMP, WORD_LABEL };
+
+class encoded_word {
+public:
+	uint32_t bits = 0;
+	word_kind kind = WORD_PLAIN;
+};
+
+// count 0 means error, label is the lbl name or the jump target
+class encoded_line {
+public:
+	encoded_word words[ENCODE_MAX_WORDS];
+	size_t count = 0;
+	std::string_view label;
+	int bound = -1;
+	const char* error = nullptr;
+};
+
+class word_fields {
+public:
+	uint32_t jmp = 0;
+	uint32_t S = 0;
+	uint32_t M = 0;
+	uint32_t P0 = 0;
+	uint32_t in_shift = 0;
+	uint32_t A = 0;
+	uint32_t wr = 0;
+	uint32_t v = 0;
+	uint32_t addr_rd = 0;
+	uint32_t addr_wr = 0;
+
+	constexpr uint32_t pack() const {
+		return jmp << 22 | S << 18 | M << 17 | P0 << 16 | in_shift << 14 | A << 13 | wr << 12 | v << 8 | addr_rd << 4 | addr_wr;
+	}
+};
+
+// v bits as written in the _ file: v[0] out, v[1] v[2] RB control, v[3] load RA
+const uint32_t V_OUT = 8;
+const uint32_t V_RB_RIGHT = 4;
+const uint32_t V_RB_LEFT = 2;
+const uint32_t V_RB_LOAD = 6;
+const uint32_t V_RA_LOAD = 1;
+
+// stoi: optional sign, digits up to the first other character
+constexpr bool parse_int(std::string_view s, int& value) {
+	size_t i = 0;
+	bool negative = false;
+	if (i < s.size() && (s[i] == '-' || s[i] == '+')) negative = s[i++] == '-';
+	if (i == s.size() || s[i] < '0' || s[i] > '9') return false;
+
+	value = 0;
+	for (; i < s.size() && s[i] >= '0' && s[i] <= '9' && value < 100000000; i++) value = value * 10 + (s[i] - '0');
+	if (negative) value = -value;
+	return true;
+}
+
+// atoi of a '!' constant, garbage reads as 0
+constexpr uint32_t const_value(std::string_view s) {
+	int value = 0;
+	if (!parse_int(s.substr(1), value)) value = 0;
+	return (uint32_t)value & 15;
+}
+
+constexpr bool is_const(std::string_view s) { return !s.empty() && s[0] == '!'; }
+constexpr bool is_in(std::string_view s) { return s == "in"; }
+
+// Write address, 0 is the temp and can't be a destination
+constexpr bool dest_addr(std::string_view s, uint32_t& addr) {
+	int value = 0;
+	if (!parse_int(s, value)) return false;
+	addr = (uint32_t)value & 15;
+	return addr != 0;
+}
+
+class line_encoder {
+public:
+	encoded_line line;
+
+	constexpr bool fail(const char* reason) {
+		line.count = 0;
+		line.error = reason;
+		return false;
+	}
+
+	constexpr void emit(const word_fields& cmd, word_kind kind = WORD_PLAIN) {
+		line.words[line.count].bits = cmd.pack();
+		line.words[line.count].kind = kind;
+		line.count++;
+	}
+
+	// cmd_const + cmd_merge: the constant shifts into RB through ISL, the last shift is merged into cmd
+	constexpr void emit_with_const(std::string_view cnst, word_fields cmd) {
+		uint32_t value = const_value(cnst);
+		word_fields shift;
+		shift.v = V_RB_LEFT;
+		for (int i = 3; i > 0; i--) {
+			shift.in_shift = (value >> i) & 1;
+			emit(shift);
+		}
+		cmd.in_shift = value & 1;
+		cmd.v = (cmd.v & ~V_RB_LOAD) | V_RB_LEFT;
+		emit(cmd);
+	}
+};
+
+// ALU instructions - field template and operand layout tables
+
+enum operand_kind { KIND_CONST, KIND_IN, KIND_ADDR };
+enum prefix_op { PRE_NONE, PRE_CONST_TO_TEMP, PRE_IN_TO_TEMP, PRE_LDA, PRE_LDA_TEMP_IN_TO_TEMP };
+enum a_source { A_IN, A_LOAD, A_LATCH };
+enum b_source { B_NONE, B_CONST, B_LOAD };
+enum operand_slot { SLOT_1, SLOT_2, SLOT_TEMP };
+
+class prefix_step {
+public:
+	prefix_op op;
+	operand_slot arg;
+};
+
+// Prefix words, where ALU operands A and B come from, total words
+class operand_layout {
+public:
+	prefix_step prefix[2];
+	a_source a;
+	operand_slot a_arg;
+	b_source b;
+	operand_slot b_arg;
+	int words;
+};
+
+class alu_op {
+public:
+	uint32_t S;
+	uint32_t M;
+	uint32_t P0;
+	bool commutative;
+	bool unary;
+};
+
+enum alu_code { ALU_ADD, ALU_SUB, ALU_AND, ALU_OR, ALU_XOR, ALU_INC, ALU_DEC };
+
+constexpr alu_op alu_ops[] = {
+	{ 0b1001, 1, 0, true, false },		// add: A plus B
+	{ 0b0110, 1, 1, false, false },		// sub: A minus B
+	{ 0b0100, 0, 0, true, false },		// and
+	{ 0b0001, 0, 0, true, false },		// or
+	{ 0b1001, 0, 0, true, false },		// xor
+	{ 0b0000, 1, 1, false, true },		// inc: A plus 1
+	{ 0b1111, 1, 0, false, true },		// dec: A minus 1
+};
+
+constexpr prefix_step NO_PREFIX = { PRE_NONE, SLOT_1 };
+
+// Operand 1 goes to A, operand 2 to B, addr 0 is the temp
+constexpr operand_layout binary_layouts[3][3] = {
+	{	// Const
+		{ { { PRE_CONST_TO_TEMP, SLOT_1 }, NO_PREFIX }, A_LOAD, SLOT_TEMP, B_CONST, SLOT_2, 8 },
+		{ { { PRE_CONST_TO_TEMP, SLOT_1 }, { PRE_LDA_TEMP_IN_TO_TEMP, SLOT_TEMP } }, A_LATCH, SLOT_1, B_LOAD, SLOT_TEMP, 6 },
+		{ { { PRE_CONST_TO_TEMP, SLOT_1 }, { PRE_LDA, SLOT_TEMP } }, A_LATCH, SLOT_1, B_LOAD, SLOT_2, 6 },
+	},
+	{	// DataIn
+		{ { NO_PREFIX, NO_PREFIX }, A_IN, SLOT_1, B_CONST, SLOT_2, 4 },
+		{ { { PRE_IN_TO_TEMP, SLOT_TEMP }, NO_PREFIX }, A_IN, SLOT_1, B_LOAD, SLOT_TEMP, 2 },
+		{ { NO_PREFIX, NO_PREFIX }, A_IN, SLOT_1, B_LOAD, SLOT_2, 1 },
+	},
+	{	// Addr
+		{ { NO_PREFIX, NO_PREFIX }, A_LOAD, SLOT_1, B_CONST, SLOT_2, 4 },
+		{ { { PRE_IN_TO_TEMP, SLOT_TEMP }, { PRE_LDA, SLOT_1 } }, A_LATCH, SLOT_1, B_LOAD, SLOT_TEMP, 3 },
+		{ { { PRE_LDA, SLOT_1 }, NO_PREFIX }, A_LATCH, SLOT_1, B_LOAD, SLOT_2, 2 },
+	},
+};
+
+constexpr operand_layout unary_layouts[3] = {
+	{ { { PRE_CONST_TO_TEMP, SLOT_1 }, NO_PREFIX }, A_LOAD, SLOT_TEMP, B_NONE, SLOT_1, 5 },
+	{ { NO_PREFIX, NO_PREFIX }, A_IN, SLOT_1, B_NONE, SLOT_1, 1 },
+	{ { NO_PREFIX, NO_PREFIX }, A_LOAD, SLOT_1, B_NONE, SLOT_1, 1 },
+};
+
+constexpr operand_kind classify(std::string_view word) {
+	if (is_const(word)) return KIND_CONST;
+	if (is_in(word)) return KIND_IN;
+	return KIND_ADDR;
+}
+
+// Register operand, parsed like stoi and cut to 4 bits
+constexpr bool read_addr(std::string_view s, uint32_t& addr) {
+	int value = 0;
+	if (!parse_int(s, value)) return false;
+	addr = (uint32_t)value & 15;
+	return true;
+}
+
+constexpr bool encode_alu(line_encoder& enc, alu_code code, const std::string_view* words, size_t count) {
+	const alu_op& op = alu_ops[code];
+	size_t operands = op.unary ? 1 : 2;
+	if (count != operands + 2) return enc.fail("wrong operand count");
+
+	std::string_view args[3] = { words[1], words[operands], "0" };
+	operand_kind kinds[2] = { classify(words[1]), classify(words[operands]) };
+
+	uint32_t to_wr = 0;
+	if (classify(words[count - 1]) != KIND_ADDR || !dest_addr(words[count - 1], to_wr)) return enc.fail("bad destination");
+	for (size_t i = 0; i < operands; i++) {
+		int value = 0;
+		if (kinds[i] == KIND_ADDR && (!parse_int(args[i], value) || value == 0)) return enc.fail("bad operand");
+	}
+
+	const operand_layout* layout = &unary_layouts[kinds[0]];
+	if (!op.unary) {
+		layout = &binary_layouts[kinds[0]][kinds[1]];
+		const operand_layout* swapped = &binary_layouts[kinds[1]][kinds[0]];
+		if (op.commutative && swapped->words < layout->words) {
+			layout = swapped;
+			std::string_view first = args[0];
+			args[0] = args[1];
+			args[1] = first;
+		}
+	}
+
+	for (const prefix_step& step : layout->prefix) {
+		word_fields cmd;
+		switch (step.op) {
+		case PRE_NONE:
+			continue;
+		case PRE_CONST_TO_TEMP:
+			cmd.S = 0b0101;
+			cmd.wr = 1;
+			enc.emit_with_const(args[step.arg], cmd);
+			continue;
+		case PRE_IN_TO_TEMP:
+			cmd.A = 1;
+			cmd.wr = 1;
+			break;
+		case PRE_LDA:
+			cmd.v = V_RA_LOAD;
+			read_addr(args[step.arg], cmd.addr_rd);
+			break;
+		case PRE_LDA_TEMP_IN_TO_TEMP:
+			cmd.A = 1;
+			cmd.wr = 1;
+			cmd.v = V_RA_LOAD;
+			break;
+		}
+		enc.emit(cmd);
+	}
+
+	word_fields cmd;
+	cmd.S = op.S;
+	cmd.M = op.M;
+	cmd.P0 = op.P0;
+	cmd.wr = 1;
+	cmd.addr_wr = to_wr;
+
+	if (layout->a == A_IN) cmd.A = 1;
+	else if (layout->a == A_LOAD) {
+		cmd.v |= V_RA_LOAD;
+		read_addr(args[layout->a_arg], cmd.addr_rd);
+	}
+
+	if (layout->b == B_CONST) enc.emit_with_const(args[layout->b_arg], cmd);
+	else {
+		if (layout->b == B_LOAD) {
+			cmd.v |= V_RB_LOAD;
+			read_addr(args[layout->b_arg], cmd.addr_rd);
+		}
+		enc.emit(cmd);
+	}
+	return true;
+}
+
+constexpr bool encode_jump(line_encoder& enc, uint32_t code, const std::string_view* words, size_t count) {
+	if (count != 2 && count != 3) return enc.fail("wrong operand count");
+	if (count == 3) {
+		// loop bound for -wcet: jump is taken at most N times in a row
+		if (words[2].empty() || words[2].find_first_not_of("0123456789") != std::string_view::npos) return enc.fail("bad loop bound");
+		parse_int(words[2], enc.line.bound);
+	}
+	enc.line.label = words[1];
+
+	word_fields cmd;
+	cmd.jmp = code;
+	enc.emit(cmd, WORD_JUMP);
+	return true;
+}
+
+// shr and shl: ldb, then RB shifts with the given bit in
+constexpr bool encode_shift(line_encoder& enc, uint32_t v, uint32_t in_shift, const std::string_view* words, size_t count) {
+	if (count != 4) return enc.fail("wrong operand count");
+	if (is_const(words[1]) || is_const(words[3]) || is_in(words[1]) || is_in(words[3])) return enc.fail("register expected");
+
+	word_fields cmd;
+	cmd.S = 0b0101;
+	cmd.wr = 1;
+	cmd.v = v;
+	if (!dest_addr(words[3], cmd.addr_wr)) return enc.fail("bad destination");
+	if (words[2] == "1") cmd.in_shift = in_shift;
+	else if (words[2] != "0") return enc.fail("shift in bit must be 0 or 1");
+
+	word_fields ldb;
+	ldb.v = V_RB_LOAD;
+	if (!read_addr(words[1], ldb.addr_rd)) return enc.fail("bad operand");
+	enc.emit(ldb);
+	enc.emit(cmd);
+	return true;
+}
+
+constexpr bool encode_mov(line_encoder& enc, const std::string_view* words, size_t count) {
+	if (count != 3) return enc.fail("wrong operand count");
+	if (is_const(words[2]) || is_in(words[2])) return enc.fail("register expected");
+
+	word_fields cmd;
+	cmd.wr = 1;
+	if (!dest_addr(words[2], cmd.addr_wr)) return enc.fail("bad destination");
+
+	if (is_const(words[1])) {
+		cmd.S = 0b0101;
+		enc.emit_with_const(words[1], cmd);
+		return true;
+	}
+	if (is_in(words[1])) cmd.A = 1;
+	else if (!read_addr(words[1], cmd.addr_rd)) return enc.fail("bad operand");
+	cmd.v = V_RA_LOAD;
+	enc.emit(cmd);
+	return true;
+}
+
+constexpr bool encode_not(line_encoder& enc, const std::string_view* words, size_t count) {
+	if (count != 3) return enc.fail("wrong operand count");
+	if (is_const(words[2]) || is_in(words[2])) return enc.fail("register expected");
+
+	word_fields cmd;
+	cmd.wr = 1;
+	if (!dest_addr(words[2], cmd.addr_wr)) return enc.fail("bad destination");
+
+	if (is_const(words[1])) {
+		cmd.S = 0b1010;
+		enc.emit_with_const(words[1], cmd);
+		return true;
+	}
+	cmd.S = 0b1111;
+	if (is_in(words[1])) cmd.A = 1;
+	else if (!read_addr(words[1], cmd.addr_rd)) return enc.fail("bad operand");
+	cmd.v = V_RA_LOAD;
+	enc.emit(cmd);
+	return true;
+}
+
+constexpr bool encode_out(line_encoder& enc, const std::string_view* words, size_t count) {
+	if (count != 3) return enc.fail("wrong operand count");
+	if (is_const(words[2]) || is_in(words[2])) return enc.fail("port expected");
+
+	word_fields cmd;
+	if (!read_addr(words[2], cmd.addr_wr)) return enc.fail("bad port");
+	cmd.addr_wr &= 3;
+
+	if (is_const(words[1])) {
+		cmd.S = 0b0101;
+		cmd.v = V_OUT;
+		enc.emit_with_const(words[1], cmd);
+		return true;
+	}
+	if (is_in(words[1])) cmd.A = 1;
+	else if (!read_addr(words[1], cmd.addr_rd)) return enc.fail("bad operand");
+	cmd.v = V_OUT | V_RA_LOAD;
+	enc.emit(cmd);
+	return true;
+}
+
+// One tokenized source line, words[0] is the mnemonic
+constexpr encoded_line encode_line(const std::string_view* words, size_t count) {
+	line_encoder enc;
+	if (count == 0) {
+		enc.fail("empty line");
+		return enc.line;
+	}
+
+	std::string_view name = words[0];
+	if (name == "nop") enc.emit(word_fields());
+	else if (name == "jne") encode_jump(enc, 0b001, words, count);
+	else if (name == "jg") encode_jump(enc, 0b010, words, count);
+	else if (name == "jl") encode_jump(enc, 0b011, words, count);
+	else if (name == "je") encode_jump(enc, 0b100, words, count);
+	else if (name == "jge") encode_jump(enc, 0b101, words, count);
+	else if (name == "jle") encode_jump(enc, 0b110, words, count);
+	else if (name == "jmp") encode_jump(enc, 0b111, words, count);
+	else if (name == "mov") encode_mov(enc, words, count);
+	else if (name == "add") encode_alu(enc, ALU_ADD, words, count);
+	else if (name == "sub") encode_alu(enc, ALU_SUB, words, count);
+	else if (name == "and") encode_alu(enc, ALU_AND, words, count);
+	else if (name == "or") encode_alu(enc, ALU_OR, words, count);
+	else if (name == "xor") encode_alu(enc, ALU_XOR, words, count);
+	else if (name == "inc") encode_alu(enc, ALU_INC, words, count);
+	else if (name == "dec") encode_alu(enc, ALU_DEC, words, count);
+	else if (name == "shr") encode_shift(enc, V_RB_RIGHT, 0b10, words, count);
+	else if (name == "shl") encode_shift(enc, V_RB_LEFT, 0b01, words, count);
+	else if (name == "not") encode_not(enc, words, count);
+	else if (name == "out") encode_out(enc, words, count);
+	else if (name == "lbl") {
+		if (count != 2) enc.fail("wrong operand count");
+		else {
+			enc.line.label = words[1];
+			enc.emit(word_fields(), WORD_LABEL);
+		}
+	}
+	else enc.fail("unknown mnemonic");
+
+	return enc.line;
+}
+
+// Compile-time assembler
+
+// Words on spaces and tabs, returns the count, ENCODE_MAX_TOKENS + 1 if there are too many
+constexpr size_t split_words(std::string_view line, std::string_view* words) {
+	size_t count = 0;
+	size_t i = 0;
+	while (true) {
+		while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) i++;
+		if (i == line.size()) return count;
+		size_t start = i;
+		while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') i++;
+		if (count == ENCODE_MAX_TOKENS) return count + 1;
+		words[count++] = line.substr(start, i - start);
+	}
+}
+
+// Calls f(line number, encoded line) for every non-blank line, a failed line has count 0
+template <typename F>
+constexpr void for_each_line(std::string_view source, F f) {
+	size_t line_no = 0;
+	while (!source.empty()) {
+		size_t eol = source.find('\n');
+		std::string_view line = source.substr(0, eol);
+		source = eol == std::string_view::npos ? std::string_view() : source.substr(eol + 1);
+		line_no++;
+
+		std::string_view words[ENCODE_MAX_TOKENS];
+		size_t count = split_words(line, words);
+		if (count == 0) continue;
+
+		encoded_line encoded;
+		if (count > ENCODE_MAX_TOKENS) encoded.error = "too many words on a line";
+		else encoded = encode_line(words, count);
+		f(line_no, encoded);
+	}
+}
+
+class label_slot {
+public:
+	std::string_view name;
+	uint32_t pos;
+};
+
+consteval std::vector<label_slot> label_slots(std::string_view source) {
+	std::vector<label_slot> slots;
+	uint32_t pos = 0;
+	for_each_line(source, [&](size_t, const encoded_line& line) {
+		if (line.count != 0 && line.words[0].kind == WORD_LABEL) slots.push_back({ line.label, pos });
+		pos += (uint32_t)line.count;
+	});
+	return slots;
+}
+
+// The last one wins for a repeated label, like in the CLI; nullptr if there is none
+constexpr const label_slot* find_label(const std::vector<label_slot>& slots, std::string_view name) {
+	const label_slot* target = nullptr;
+	for (const label_slot& slot : slots) if (slot.name == name) target = &slot;
+	return target;
+}
+
+// Error reason as a template argument, so the compiler prints it
+class error_text {
+public:
+	char text[32] = {};
+
+	constexpr error_text() {}
+	constexpr error_text(const char* s) {
+		for (size_t i = 0; i + 1 < sizeof(text) && s[i]; i++) text[i] = s[i];
+	}
+};
+
+// line 0 means no error, lines count from the one R"( is on
+class assembly_status {
+public:
+	size_t line = 0;
+	error_text reason;
+};
+
+consteval assembly_status check_source(std::string_view source) {
+	std::vector<label_slot> slots = label_slots(source);
+	assembly_status status;
+	for_each_line(source, [&](size_t line_no, const encoded_line& line) {
+		if (status.line != 0) return;
+		const char* error = line.error;
+		if (line.count != 0 && line.words[line.count - 1].kind == WORD_JUMP) {
+			const label_slot* target = find_label(slots, line.label);
+			if (target == nullptr) error = "label not found";
+			else if (target->pos > JUMP_DEST_MAX) error = "label out of jump range";
+		}
+		if (error == nullptr) return;
+		status.line = line_no;
+		status.reason = error_text(error);
+	});
+	return status;
+}
+
+// The failing line and reason show in the instantiation, e.g. assembly_failed<3, error_text{"bad operand"}>
+template <size_t Line, error_text Reason>
+class assembly_failed {
+public:
+	static_assert(Line == 0, "assembly error, the line and reason are the arguments of assembly_failed");
+	static constexpr bool ok = true;
+};
+
+// Failed lines add nothing, check_source stops the compilation on them
+consteval size_t program_size(std::string_view source) {
+	size_t size = 0;
+	for_each_line(source, [&](size_t, const encoded_line& line) { size += line.count; });
+	return size;
+}
+
+template <size_t N>
+consteval std::array<uint32_t, N> assemble_words(std::string_view source) {
+	std::vector<label_slot> slots = label_slots(source);
+	std::array<uint32_t, N> program{};
+	size_t pos = 0;
+	for_each_line(source, [&](size_t, const encoded_line& line) {
+		for (size_t k = 0; k < line.count; k++) {
+			const encoded_word& word = line.words[k];
+			uint32_t bits = word.kind == WORD_LABEL ? 0 : word.bits;
+			if (word.kind == WORD_JUMP) {
+				const label_slot* target = find_label(slots, line.label);
+				if (target != nullptr) bits |= target->pos & JUMP_DEST_MAX;
+			}
+			program[pos++] = bits;
+		}
+	});
+	return program;
+}
+
+// Source text as a template argument, so a string literal can name a program
+template <size_t N>
+class source_text {
+public:
+	char text[N] = {};
+
+	consteval source_text(const char (&s)[N]) {
+		for (size_t i = 0; i < N; i++) text[i] = s[i];
+	}
+
+	constexpr std::string_view view() const { return std::string_view(text, N - 1); }
+};
+
+template <source_text Source, assembly_status Status = check_source(Source.view())>
+inline constexpr std::array<uint32_t, program_size(Source.view())> microprogram =
+	(assembly_failed<Status.line, Status.reason>::ok, assemble_words<program_size(Source.view())>(Source.view()));
@@ -0,0 +1,152 @@
+#include "Loader.h"
+#include <cstring>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LOADER_SSE2
+#endif
+
+using namespace std;
+
+const size_t WORD_LENGTH = 25;
+
+class mapped_file {
+public:
+	const char* data = nullptr;
+	size_t size = 0;
+
+	bool open(const char* path) {
+#if defined(_WIN32)
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER length;
+		if (!GetFileSizeEx(file, &length)) return false;
+		size = (size_t)length.QuadPart;
+		if (size == 0) return true;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) return false;
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		return data != nullptr;
+#else
+		fd = ::open(path, O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0) return false;
+		size = (size_t)st.st_size;
+		if (size == 0) return true;
+		void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED) return false;
+		madvise(view, size, MADV_SEQUENTIAL);
+		data = (const char*)view;
+		return true;
+#endif
+	}
+
+	~mapped_file() {
+#if defined(_WIN32)
+		if (data) UnmapViewOfFile(data);
+		if (mapping != NULL) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (data) munmap((void*)data, size);
+		if (fd >= 0) close(fd);
+#endif
+	}
+
+private:
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+};
+
+static inline uint32_t reverse_bits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+	x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+	x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+	x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+bool pack_word(const char* line, size_t length, uint32_t& word) {
+	if (length != WORD_LENGTH) return false;
+
+#ifdef LOADER_SSE2
+	// chars 0-15 and 9-24, every byte has to be '0' or '1'
+	__m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i*)line), _mm_set1_epi8('0'));
+	__m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(line + 9)), _mm_set1_epi8('0'));
+	__m128i one = _mm_set1_epi8(1);
+	__m128i bad = _mm_or_si128(_mm_andnot_si128(one, lo), _mm_andnot_si128(one, hi));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xFFFF) return false;
+
+	uint32_t lo_mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, one));
+	uint32_t hi_mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, one));
+	// bit i is char i, chars 16-24 are bits 7-15 of the second load
+	uint32_t mask = lo_mask | ((hi_mask >> 7) << 16);
+	word = reverse_bits(mask) >> 7;
+	return true;
+#else
+	uint32_t result = 0;
+	for (size_t i = 0; i < WORD_LENGTH; i++) {
+		char c = line[i];
+		if (c != '0' && c != '1') return false;
+		result = (result << 1) | (uint32_t)(c - '0');
+	}
+	word = result;
+	return true;
+#endif
+}
+
+int load_program(const char* path, vector<uint32_t>& words) {
+	mapped_file file;
+	if (!file.open(path)) return -1;
+
+	const char* p = file.data;
+	const char* end = p + file.size;
+
+	if (file.size >= 4 && memcmp(p, BINARY_MAGIC, 4) == 0) {
+		const uint8_t* bytes = (const uint8_t*)p + 4;
+		size_t count = (file.size - 4) / 4;
+		if (count * 4 != file.size - 4) return (int)count + 1;
+		words.reserve(words.size() + count);
+		for (size_t i = 0; i < count; i++, bytes += 4) words.push_back(bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24);
+		return 0;
+	}
+
+	words.reserve(words.size() + file.size / (WORD_LENGTH + 1) + 1);
+
+	int line = 1;
+	while (p < end) {
+		// a run of 25 label slots also has '\n' at the word length, pack_word tells them apart
+		const char* eol;
+		uint32_t word = 0;
+		if ((size_t)(end - p) > WORD_LENGTH && p[WORD_LENGTH] == '\n' && pack_word(p, WORD_LENGTH, word)) eol = p + WORD_LENGTH;
+		else {
+			eol = (const char*)memchr(p, '\n', (size_t)(end - p));
+			if (eol == nullptr) eol = end;
+
+			size_t length = (size_t)(eol - p);
+			if (length > 0 && p[length - 1] == '\r') length--;
+			if (length != 0 && !pack_word(p, length, word)) return line;
+		}
+		words.push_back(word);
+
+		p = eol + 1;
+		line++;
+	}
+
+	return 0;
+}
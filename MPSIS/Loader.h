@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Packs one 25 char bit line, returns false on wrong length or character
+bool pack_word(const char* line, size_t length, uint32_t& word);
+
+// Binary _ files from -stream bin start with these 4 bytes, then 4 byte little endian words
+inline constexpr char BINARY_MAGIC[] = "MPSB";
+
+// Loads an assembled _ file, text or binary, empty lines are label slots (nop)
+// Returns 0 on success, -1 if file can't be opened, else number of the first bad line
+int load_program(const char* path, std::vector<uint32_t>& words);
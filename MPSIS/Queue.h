@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+
+// Bounded lock-free queue for one producer and one consumer thread, holds N - 1 items
+template <typename T, size_t N>
+class spsc_queue {
+public:
+	// Moves item in, false if the queue is full
+	bool push(T& item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t next = (t + 1) % N;
+		if (next == head.load(std::memory_order_acquire)) return false;
+		items[t] = std::move(item);
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		item = std::move(items[h]);
+		head.store((h + 1) % N, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+	// Spin until done, false if cancel was set meanwhile
+	bool push_wait(T& item, const std::atomic<bool>& cancel) {
+		while (!push(item)) {
+			if (cancel.load(std::memory_order_relaxed)) return false;
+			std::this_thread::yield();
+		}
+		return true;
+	}
+
+	bool pop_wait(T& item, const std::atomic<bool>& cancel) {
+		while (!pop(item)) {
+			if (cancel.load(std::memory_order_relaxed)) return false;
+			std::this_thread::yield();
+		}
+		return true;
+	}
+
+private:
+	T items[N];
+	alignas(64) std::atomic<size_t> head{ 0 };
+	alignas(64) std::atomic<size_t> tail{ 0 };
+};
@@ -0,0 +1,31 @@
+#include "SharedPorts.h"
+#include "Simulator.h"
+
+using namespace std;
+
+uint64_t sim_shared(machine& m, const vector<uint32_t>& program, uint64_t max_cycles, shared_ports& ports) {
+	while (!ports.host_attached.load(memory_order_acquire)) this_thread::sleep_for(chrono::milliseconds(1));
+
+	ring_reader in(ports.in);
+	ring_writer out[4] = { ring_writer(ports.out[0]), ring_writer(ports.out[1]), ring_writer(ports.out[2]), ring_writer(ports.out[3]) };
+	const uint32_t* words = program.data();
+	size_t size = program.size();
+
+	// one value per loop iteration: the first DataIn read after the start or a taken backward jump takes it
+	bool fresh = false;
+	while (m.pc < size && m.cycles < max_cycles) {
+		uint32_t pc = m.pc;
+		uint32_t word = words[pc];
+		// jump words keep these bits clear, so only ALU words pass
+		if ((word & 0x2000) && !fresh) {
+			if (!in.pop_wait(m.in, ports.input_closed)) break;
+			fresh = true;
+		}
+		sim_step(m, word);
+		if (word & 0x800) out[word & 3].push_wait(m.out[word & 3]);
+		if (m.pc <= pc) fresh = false;
+	}
+
+	ports.finished.store(1, memory_order_release);
+	return m.cycles;
+}
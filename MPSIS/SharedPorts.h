@@ -0,0 +1,210 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/* SHARED PORTS - MPSIS -shm _file name [cycles]
+
+DataIn and the 4 out ports are lock-free rings in a shared memory segment, a testbench process
+includes only this header to drive the simulator:
+
+	shared_segment segment;
+	segment.open("bench");							// waits for the simulator to create it
+	ring_writer in(segment.ports->in);
+	ring_reader out(segment.ports->out[0]);
+	in.push(5);
+	segment.ports->input_closed = 1;				// no more DataIn values, the simulator stops when it needs one
+
+Each value is taken once: the first word reading DataIn (A = 1) after the start or after a taken backward jump
+pops the next one, waiting for the host if the ring is empty; later reads in that iteration see the same value,
+so an instruction reading DataIn through several words, like add in in X, gets one value
+Every out strobe appends the value to the ring of its port, waiting if the ring is full
+finished is set when the simulator is done, nothing is added to the out rings after that
+
+*/
+
+const uint32_t SHARED_PORTS_MAGIC = 0x4853504D;
+const uint32_t PORT_RING_SIZE = 1 << 16;
+
+// One producer and one consumer process, indices run free and wrap
+class port_ring {
+public:
+	alignas(64) std::atomic<uint32_t> head{ 0 };
+	alignas(64) std::atomic<uint32_t> tail{ 0 };
+	alignas(64) uint8_t items[PORT_RING_SIZE] = {};
+};
+
+class shared_ports {
+public:
+	std::atomic<uint32_t> magic{ 0 };
+	std::atomic<uint32_t> host_attached{ 0 };
+	std::atomic<uint32_t> input_closed{ 0 };
+	std::atomic<uint32_t> finished{ 0 };
+	port_ring in;
+	port_ring out[4];
+};
+
+// Spins a while, then gives the core away
+inline void ring_backoff(uint32_t& spins) {
+	if (++spins > 64) std::this_thread::yield();
+}
+
+// Producer side, the consumer index is cached so most pushes don't touch its cache line
+class ring_writer {
+public:
+	explicit ring_writer(port_ring& r) : ring(&r), tail(r.tail.load(std::memory_order_relaxed)), head_seen(r.head.load(std::memory_order_acquire)) {}
+
+	bool push(uint8_t value) {
+		if (tail - head_seen == PORT_RING_SIZE) {
+			head_seen = ring->head.load(std::memory_order_acquire);
+			if (tail - head_seen == PORT_RING_SIZE) return false;
+		}
+		ring->items[tail & (PORT_RING_SIZE - 1)] = value;
+		ring->tail.store(++tail, std::memory_order_release);
+		return true;
+	}
+
+	void push_wait(uint8_t value) {
+		for (uint32_t spins = 0; !push(value);) ring_backoff(spins);
+	}
+
+private:
+	port_ring* ring;
+	uint32_t tail;
+	uint32_t head_seen;
+};
+
+// Consumer side, the producer index is cached the same way
+class ring_reader {
+public:
+	explicit ring_reader(port_ring& r) : ring(&r), head(r.head.load(std::memory_order_relaxed)), tail_seen(r.tail.load(std::memory_order_acquire)) {}
+
+	bool pop(uint8_t& value) {
+		if (head == tail_seen) {
+			tail_seen = ring->tail.load(std::memory_order_acquire);
+			if (head == tail_seen) return false;
+		}
+		value = ring->items[head & (PORT_RING_SIZE - 1)];
+		ring->head.store(++head, std::memory_order_release);
+		return true;
+	}
+
+	// Waits for a value, false once closed is set and the ring is drained
+	bool pop_wait(uint8_t& value, const std::atomic<uint32_t>& closed) {
+		for (uint32_t spins = 0; !pop(value);) {
+			if (closed.load(std::memory_order_acquire)) return pop(value);
+			ring_backoff(spins);
+		}
+		return true;
+	}
+
+private:
+	port_ring* ring;
+	uint32_t head;
+	uint32_t tail_seen;
+};
+
+class shared_segment {
+public:
+	shared_ports* ports = nullptr;
+
+	// Simulator side, replaces a stale segment of the same name
+	bool create(const char* name) {
+		owner = true;
+		path = segment_path(name);
+#if defined(_WIN32)
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(shared_ports), path.c_str());
+		if (mapping == NULL) return false;
+		void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(shared_ports));
+		if (view == nullptr) return false;
+#else
+		shm_unlink(path.c_str());
+		int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0) return false;
+		void* view = ftruncate(fd, sizeof(shared_ports)) == 0 ? mmap(nullptr, sizeof(shared_ports), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		close(fd);
+		if (view == MAP_FAILED) return false;
+#endif
+		ports = new (view) shared_ports();
+		ports->magic.store(SHARED_PORTS_MAGIC, std::memory_order_release);
+		return true;
+	}
+
+	// Host side, waits up to timeout_ms for the simulator to create the segment
+	bool open(const char* name, int timeout_ms = 10000) {
+		path = segment_path(name);
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		while (!try_open()) {
+			if (std::chrono::steady_clock::now() > deadline) return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		ports->host_attached.store(1, std::memory_order_release);
+		return true;
+	}
+
+	~shared_segment() {
+#if defined(_WIN32)
+		if (ports) UnmapViewOfFile(ports);
+		if (mapping != NULL) CloseHandle(mapping);
+#else
+		if (ports) munmap(ports, sizeof(shared_ports));
+		if (owner) shm_unlink(path.c_str());
+#endif
+	}
+
+private:
+	std::string path;
+	bool owner = false;
+#if defined(_WIN32)
+	HANDLE mapping = NULL;
+#endif
+
+	static std::string segment_path(const char* name) {
+#if defined(_WIN32)
+		return std::string("Local\\") + name;
+#else
+		return std::string("/") + name;
+#endif
+	}
+
+	bool try_open() {
+#if defined(_WIN32)
+		if (mapping == NULL) mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, path.c_str());
+		if (mapping == NULL) return false;
+		if (ports == nullptr) ports = (shared_ports*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(shared_ports));
+		if (ports == nullptr) return false;
+#else
+		if (ports == nullptr) {
+			int fd = shm_open(path.c_str(), O_RDWR, 0600);
+			if (fd < 0) return false;
+			// the creator may not have sized it yet
+			off_t size = lseek(fd, 0, SEEK_END);
+			void* view = size >= (off_t)sizeof(shared_ports) ? mmap(nullptr, sizeof(shared_ports), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+			close(fd);
+			if (view == MAP_FAILED) return false;
+			ports = (shared_ports*)view;
+		}
+#endif
+		return ports->magic.load(std::memory_order_acquire) == SHARED_PORTS_MAGIC;
+	}
+};
+
+class machine;
+
+// sim_run with DataIn and out ports on the shared rings, waits for the host to attach first
+uint64_t sim_shared(machine& m, const std::vector<uint32_t>& program, uint64_t max_cycles, shared_ports& ports);
@@ -0,0 +1,79 @@
+#include "Simulator.h"
+
+using namespace std;
+
+// Everything but the cycle count, registers in one half and the rest in the other
+class state_key {
+public:
+	uint64_t rf = 0;
+	uint64_t rest = 0;
+
+	explicit state_key(const machine& m) {
+		for (int i = 0; i < 16; i++) rf |= (uint64_t)m.rf[i] << (i * 4);
+		rest = m.pc | (uint64_t)m.ra << 32 | (uint64_t)m.rb << 36 | (uint64_t)m.z << 40 | (uint64_t)m.c << 41;
+		for (int i = 0; i < 4; i++) rest |= (uint64_t)m.out[i] << (42 + i * 4);
+	}
+
+	bool operator==(const state_key& other) const { return rf == other.rf && rest == other.rest; }
+};
+
+uint64_t sim_run(machine& m, const vector<uint32_t>& program, uint64_t max_cycles) {
+	const uint32_t* words = program.data();
+	size_t size = program.size();
+
+	// DataIn is constant here, so a state seen again at a back-edge repeats forever
+	// Brent's cycle detection on every BACK_EDGE_SAMPLE-th back-edge, one saved state moved at powers of two
+	const uint32_t BACK_EDGE_SAMPLE = 16;
+	state_key saved(m);
+	uint64_t saved_cycles = m.cycles;
+	uint64_t power = 1;
+	uint64_t length = 0;
+	uint32_t countdown = BACK_EDGE_SAMPLE;
+	bool skipped = false;
+
+	while (m.pc < size && m.cycles < max_cycles) {
+		uint32_t pc = m.pc;
+		uint32_t word = words[pc];
+		uint32_t jmp = word >> 22;
+		if (!jmp) {
+			sim_step(m, word);
+			continue;
+		}
+
+		m.cycles++;
+		if (!sim_cond(jmp, m)) {
+			m.pc++;
+			continue;
+		}
+		m.pc = word & 0xFF;
+		if (m.pc > pc || --countdown || skipped) continue;
+		countdown = BACK_EDGE_SAMPLE;
+
+		state_key key(m);
+		if (key == saved) {
+			uint64_t period = m.cycles - saved_cycles;
+			m.cycles += (max_cycles - m.cycles) / period * period;
+			skipped = true;
+		}
+		else if (++length == power) {
+			saved = key;
+			saved_cycles = m.cycles;
+			power *= 2;
+			length = 0;
+		}
+	}
+	return m.cycles;
+}
+
+void sim_print(const machine& m, ostream& os) {
+	os << "cycles: " << m.cycles << endl;
+	os << "pc: " << m.pc << endl;
+	os << "rf:";
+	for (int i = 0; i < 16; i++) os << ' ' << (int)m.rf[i];
+	os << endl;
+	os << "ra: " << (int)m.ra << " rb: " << (int)m.rb << endl;
+	os << "z: " << (int)m.z << " c: " << (int)m.c << endl;
+	os << "out:";
+	for (int i = 0; i < 4; i++) os << ' ' << (int)m.out[i];
+	os << endl;
+}
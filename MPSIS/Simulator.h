@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/* PACKED WORD - bit 24 is the first character of a line in the _ file
+
+[24-22] jmp
+[21-18] S
+[17]    M
+[16]    P0
+[15-14] ISR, ISL
+[13]    A
+[12]    wr
+[11-8]  v
+[7-4]   addr1
+[3-0]   addr2
+[7-0]   jump destination (jmp != 000)
+
+DATAPATH:
+
+* v[0] (bit 11) - strobe ALU result into out port addr2 & 3
+* v[1] v[2] (bits 10, 9) - RB control: 10 shift right (ISR in), 01 shift left (ISL in), 11 load RF[addr1]
+* v[3] (bit 8) - load RA from RF[addr1]
+* Latches are transparent - ALU sees the values loaded in the same word
+* ALU operand A is RA or DataIn (A = 1), operand B is RB
+* ALU is 74181-like: M = 1 arithmetic with carry-in P0, M = 0 logic
+* wr - RF[addr2] = F, flags Z and C are updated only by written results
+* Label slots are empty lines and run as nop
+
+*/
+
+class machine {
+public:
+	uint8_t rf[16] = {};
+	uint8_t ra = 0;
+	uint8_t rb = 0;
+	uint8_t out[4] = {};
+	uint8_t in = 0;
+	uint8_t z = 0;
+	uint8_t c = 0;
+	uint32_t pc = 0;
+	uint64_t cycles = 0;
+};
+
+inline bool sim_cond(uint32_t jmp, const machine& m) {
+	switch (jmp) {
+	case 1: return !m.z;			// jne
+	case 2: return m.c && !m.z;		// jg
+	case 3: return !m.c;			// jl
+	case 4: return m.z;				// je
+	case 5: return m.c;				// jge
+	case 6: return !m.c || m.z;		// jle
+	default: return true;			// jmp
+	}
+}
+
+constexpr void sim_alu(uint32_t s, uint32_t mode, uint32_t p0, uint32_t a, uint32_t b, uint32_t& f, uint32_t& carry) {
+	uint32_t s0 = (s & 1) ? 15 : 0;
+	uint32_t s1 = (s & 2) ? 15 : 0;
+	uint32_t s2 = (s & 4) ? 15 : 0;
+	uint32_t s3 = (s & 8) ? 15 : 0;
+	uint32_t x = (a | (b & s0) | (~b & s1)) & 15;
+	uint32_t y = ((a & b & s3) | (a & ~b & s2)) & 15;
+
+	if (mode) {
+		uint32_t sum = x + y + p0;
+		f = sum & 15;
+		carry = sum >> 4;
+	}
+	else {
+		f = x ^ y;
+		carry = 0;
+	}
+}
+
+// Every S M P0 A B combination, entry is F | C << 4 | Z << 5
+class alu_table {
+public:
+	uint8_t entries[1 << 14] = {};
+
+	constexpr alu_table() {
+		for (uint32_t i = 0; i < (1 << 14); i++) {
+			uint32_t f = 0, carry = 0;
+			sim_alu(i >> 10, (i >> 9) & 1, (i >> 8) & 1, (i >> 4) & 15, i & 15, f, carry);
+			entries[i] = (uint8_t)(f | (carry << 4) | ((f == 0) << 5));
+		}
+	}
+};
+
+inline constexpr alu_table ALU_TABLE;
+
+inline void sim_step(machine& m, uint32_t word) {
+	m.cycles++;
+
+	uint32_t jmp = word >> 22;
+	if (jmp) {
+		m.pc = sim_cond(jmp, m) ? (word & 0xFF) : m.pc + 1;
+		return;
+	}
+
+	uint8_t rd = m.rf[(word >> 4) & 15];
+	if (word & 0x100) m.ra = rd;
+	switch ((word >> 9) & 3) {
+	case 1: m.rb = ((m.rb << 1) | ((word >> 14) & 1)) & 15; break;
+	case 2: m.rb = (m.rb >> 1) | (((word >> 15) & 1) << 3); break;
+	case 3: m.rb = rd; break;
+	}
+
+	uint32_t a = (word & 0x2000) ? m.in : m.ra;
+	uint8_t entry = ALU_TABLE.entries[((word >> 8) & 0x3F00) | (a << 4) | m.rb];
+	uint8_t f = entry & 15;
+
+	if (word & 0x1000) {
+		m.rf[word & 15] = f;
+		m.z = (entry >> 5) & 1;
+		m.c = (entry >> 4) & 1;
+	}
+	if (word & 0x800) m.out[word & 3] = f;
+
+	m.pc++;
+}
+
+uint64_t sim_run(machine& m, const std::vector<uint32_t>& program, uint64_t max_cycles);
+void sim_print(const machine& m, std::ostream& os);
@@ -4,6 +4,23 @@
 #include <vector>
 #include <map>
 #include <bitset>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include "Analyzer.h"
+#include "Cosim.h"
+#include "Debugger.h"
+#include "Encoder.h"
+#include "Loader.h"
+#include "Queue.h"
+#include "SharedPorts.h"
+#include "Simulator.h"
+#include "Superopt.h"
+#include "Timing.h"
+#include "Trace.h"
+#include "Translate.h"
 
 using namespace std;
 
@@ -43,6 +60,7 @@ COMMAND RULES:
 * Keyword 'in' mean DataIn
 * Don't use addr 0
 * Jump only on label
+* Jump may end with a loop bound for -wcet: 'jne loop 16'
 
 */
 
@@ -68,968 +86,815 @@ public:
 		in_shift = init.substr(9, 2);
 		A = init.substr(11, 1);
 		wr = init.substr(12, 1);
+		if (init.length() < 25) return;
+		v = init.substr(13, 4);
+		addr_rd = init.substr(17, 4);
+		addr_wr = init.substr(21, 4);
 	}
 
-	string result() { return jmp + S + P0 + in_shift + A + wr + v + addr_rd + addr_wr; }
+	string result() { return jmp + S + M + P0 + in_shift + A + wr + v + addr_rd + addr_wr; }
 };
 
-map<string, vector<string>(*)(vector<string>&)> commands;
 map<string, int> labels;
 map<int, string> jmps;
+map<int, int> bounds;
+vector<int> source_lines;
+peephole_table peephole;
 int current_pos = 0;
 
-vector<string> break_word(string& line) {
-	vector<string> words;
-	int space_pos = 0;
-	int prev_pos = 0;
-	while ((space_pos = (int)line.find(' ', prev_pos)) != string::npos) {
-		words.push_back(line.substr(prev_pos, (uint64_t)space_pos - prev_pos));
-		prev_pos = space_pos + 1;
-	}
-	string last = line.substr(prev_pos);
-	words.push_back(last.substr(0, last.length() - 1));
-	return words;
-}
-
-vector<string> jmp_body(string code, string& dest) {
-	jmps[current_pos] = dest;
-	current_pos++;
-
-	command cmd;
-	cmd.jmp = code;
-	cmd.addr_rd = "";
-	cmd.addr_wr = "";
-
+// Hand-checked words of the shared encoder, checked by the compiler at no runtime cost
+static_assert(microprogram<"mov 4 3">[0] == (1u << 12 | 1u << 8 | 4u << 4 | 3u));		// wr, load RA, rd 4, wr 3
+static_assert(microprogram<"out 4 2">[0] == (1u << 11 | 1u << 8 | 4u << 4 | 2u));		// strobe, load RA, rd 4, port 2
+static_assert(microprogram<"\tmov !5 1\n\tlbl loop\n\tdec 1 1\n\tjne loop\n">.size() == 7);
+static_assert(microprogram<"\tmov !5 1\n\tlbl loop\n\tdec 1 1\n\tjne loop\n">[4] == 0);	// lbl
+static_assert(microprogram<"\tmov !5 1\n\tlbl loop\n\tdec 1 1\n\tjne loop\n">[6] == (1u << 22 | 4u));	// jne, to the word after lbl
+static_assert(microprogram<"add in 4 3">.size() == 1 && microprogram<"add 4 5 3">.size() == 2);
+
+// Encodes one line with the shared encoder, labels, jumps and loop bounds go to the globals
+vector<string> encode_words(vector<string>& words) {
+	if (words.size() > ENCODE_MAX_TOKENS) return vector<string>();
+	string_view views[ENCODE_MAX_TOKENS];
+	for (size_t i = 0; i < words.size(); i++) views[i] = words[i];
+
+	encoded_line line = encode_line(views, words.size());
 	vector<string> result;
-	result.push_back(cmd.result());
+	for (size_t k = 0; k < line.count; k++) {
+		const encoded_word& word = line.words[k];
+		switch (word.kind) {
+		case WORD_LABEL:
+			labels[string(line.label)] = current_pos + 1;
+			result.push_back("");
+			break;
+		case WORD_JUMP:
+			jmps[current_pos] = string(line.label);
+			if (line.bound >= 0) bounds[current_pos] = line.bound;
+			result.push_back(bitset<17>(word.bits >> 8).to_string());
+			break;
+		default:
+			result.push_back(bitset<25>(word.bits).to_string());
+			break;
+		}
+		current_pos++;
+	}
 	return result;
 }
-vector<string> cmd_lda(string& addr) {
-	current_pos++;
-
-	command cmd;
-	cmd.addr_rd = bitset<4>(stoi(addr)).to_string();
-	cmd.v = "0001";
 
-	vector<string> result;
-	result.push_back(cmd.result());
-	return result;
+// Removes dropped words and renumbers labels, jumps, bounds and source lines
+void remove_words(vector<string>& program, const vector<char>& drop) {
+	int size = (int)program.size();
+	vector<int> new_pos(size + 1);
+	int kept = 0;
+	for (int i = 0; i < size; i++) {
+		new_pos[i] = kept;
+		if (drop[i]) continue;
+		program[kept] = program[i];
+		source_lines[kept] = source_lines[i];
+		kept++;
+	}
+	new_pos[size] = kept;
+	if (kept == size) return;
+
+	program.resize(kept);
+	source_lines.resize(kept);
+	current_pos -= size - kept;
+
+	for (auto& kvp : labels) kvp.second = new_pos[kvp.second - 1] + 1;
+	map<int, string> new_jmps;
+	for (auto const& kvp : jmps) new_jmps[new_pos[kvp.first]] = kvp.second;
+	jmps.swap(new_jmps);
+	map<int, int> new_bounds;
+	for (auto const& kvp : bounds) new_bounds[new_pos[kvp.first]] = kvp.second;
+	bounds.swap(new_bounds);
 }
-vector<string> cmd_ldb(string& addr) {
-	current_pos++;
 
-	command cmd;
-	cmd.addr_rd = bitset<4>(stoi(addr)).to_string();
-	cmd.v = "0110";
+// Latch contents for drop_reloads: register held by RA and RB, -1 unknown
+class latches {
+public:
+	int ra = -1;
+	int rb = -1;
+
+	bool merge(const latches& other) {
+		latches old = *this;
+		if (ra != other.ra) ra = -1;
+		if (rb != other.rb) rb = -1;
+		return ra != old.ra || rb != old.rb;
+	}
+};
 
-	vector<string> result;
-	result.push_back(cmd.result());
-	return result;
+latches latches_after(const string& word, latches state) {
+	if (word.length() != 25) return state;
+
+	command cmd(word);
+	int rd = stoi(cmd.addr_rd, nullptr, 2);
+	if (cmd.v[3] == '1') state.ra = rd;
+	if (cmd.v[1] == '1' && cmd.v[2] == '1') state.rb = rd;
+	else if (cmd.v[1] == '1' || cmd.v[2] == '1') state.rb = -1;
+	if (cmd.wr == "1") {
+		int wa = stoi(cmd.addr_wr, nullptr, 2);
+		if (state.ra == wa) state.ra = -1;
+		if (state.rb == wa) state.rb = -1;
+	}
+	return state;
 }
-vector<command> cmd_const(string cnst) {
-	current_pos += 3;
 
-	vector<command> ret;
-	bitset<4> bitnum = atoi(cnst.c_str() + 1);
-	command cmd;
-	cmd.v = "0010";
+// Drops lda/ldb words whose latch already holds that register on every path
+void drop_reloads(vector<string>& program) {
+	int size = (int)program.size();
+	vector<int> targets(size, -1);
+	for (auto const& kvp : jmps) {
+		auto it = labels.find(kvp.second);
+		if (it != labels.end()) targets[kvp.first] = it->second - 1;
+	}
 
-	for (int i = 3; i >= 0; i--) {
-		cmd.in_shift[0] = bitnum[i] + '0';
-		ret.push_back(cmd);
+	vector<latches> in(size);
+	vector<char> visited(size, 0);
+	vector<int> work;
+	if (size > 0) {
+		visited[0] = 1;
+		work.push_back(0);
+	}
+	while (!work.empty()) {
+		int i = work.back();
+		work.pop_back();
+
+		latches out = latches_after(program[i], in[i]);
+		bool falls = targets[i] < 0 || program[i].substr(0, 3) != "111";
+		int next[2] = { falls ? i + 1 : -1, targets[i] };
+		for (int s : next) {
+			if (s < 0 || s >= size) continue;
+			if (!visited[s]) {
+				visited[s] = 1;
+				in[s] = out;
+			}
+			else if (!in[s].merge(out)) continue;
+			work.push_back(s);
+		}
 	}
 
-	return ret;
+	vector<char> drop(size, 0);
+	for (int i = 0; i < size; i++) {
+		string& word = program[i];
+		if (word.length() != 25 || !visited[i]) continue;
+
+		command cmd(word);
+		command load;
+		load.v = cmd.v;
+		load.addr_rd = cmd.addr_rd;
+		int rd = stoi(cmd.addr_rd, nullptr, 2);
+		if (load.result() == word && ((cmd.v == "0001" && in[i].ra == rd) || (cmd.v == "0110" && in[i].rb == rd))) drop[i] = 1;
+	}
+	remove_words(program, drop);
 }
-vector<string> cmd_merge(vector<command>& cnst, command& cmd) {
-	vector<string> result;
-	result.push_back(cnst[0].result());
 
-	cmd.in_shift = cnst[3].in_shift;
-	cmd.v[1] = cnst[3].v[1];
-	cmd.v[2] = cnst[3].v[2];
-	cnst[3] = cmd;
-	for (uint32_t i = 1; i < 4; i++) result.push_back(cnst[i].result());
+// Replaces word windows found in the peephole table, windows don't cross labels or jumps
+void apply_peephole(vector<string>& program) {
+	if (peephole.empty()) return;
+
+	size_t max_window = 0;
+	for (auto const& kvp : peephole) max_window = max(max_window, (size_t)count(kvp.first.begin(), kvp.first.end(), ' ') + 1);
+
+	int size = (int)program.size();
+	vector<char> drop(size, 0);
+	for (int i = 0; i < size; i++) {
+		string key;
+		size_t len = 0;
+		size_t matched = 0;
+		string replacement;
+		while (len < max_window && i + (int)len < size && program[i + len].length() == 25) {
+			if (len > 0) key += ' ';
+			key += program[i + len];
+			len++;
+			auto it = len > 1 ? peephole.find(key) : peephole.end();
+			if (it != peephole.end()) {
+				matched = len;
+				replacement = it->second;
+			}
+		}
+		if (matched == 0) continue;
 
-	return result;
+		program[i] = replacement;
+		for (size_t k = 1; k < matched; k++) drop[i + k] = 1;
+		i += (int)matched - 1;
+	}
+	remove_words(program, drop);
 }
 
-vector<string> cmd_nop(vector<string>& words) {
-	current_pos++;
-	command cmd;
-
-	vector<string> result;
-	result.push_back(cmd.result());
-	return result;
-}
-vector<string> cmd_jne(vector<string>& words) {
-	if (words.size() != 2) return vector<string>();
-	return jmp_body("001", words[1]);
-}
-vector<string> cmd_jg(vector<string>& words) {
-	if (words.size() != 2) return vector<string>();
-	return jmp_body("010", words[1]);
-}
-vector<string> cmd_jl(vector<string>& words) {
-	if (words.size() != 2) return vector<string>();
-	return jmp_body("011", words[1]);
-}
-vector<string> cmd_je(vector<string>& words) {
-	if (words.size() != 2) return vector<string>();
-	return jmp_body("100", words[1]);
-}
-vector<string> cmd_jge(vector<string>& words) {
-	if (words.size() != 2) return vector<string>();
-	return jmp_body("101", words[1]);
+int error(ifstream& fin, ofstream& fout) {
+	fout << "Error" << endl;
+	fin.close();
+	fout.close();
+	return -1;
 }
-vector<string> cmd_jle(vector<string>& words) {
-	if (words.size() != 2) return vector<string>();
-	return jmp_body("110", words[1]);
+
+bool load_or_report(const char* path, vector<uint32_t>& program) {
+	int status = load_program(path, program);
+	if (status < 0) cout << "Can't open '" << path << "'" << endl;
+	else if (status > 0) cout << "Line " << status << ": bad word" << endl;
+	return status == 0;
 }
-vector<string> cmd_jmp(vector<string>& words) {
-	if (words.size() != 2) return vector<string>();
-	return jmp_body("111", words[1]);
+
+// MPSIS -run _file [DataIn] [max cycles]
+int run(int argc, char** argv) {
+	if (argc < 3 || argc > 5) return -1;
+
+	vector<uint32_t> program;
+	if (!load_or_report(argv[2], program)) return -1;
+
+	machine m;
+	if (argc > 3) m.in = stoi(argv[3]) & 15;
+	uint64_t max_cycles = argc > 4 ? stoull(argv[4]) : 1000000;
+
+	sim_run(m, program, max_cycles);
+	sim_print(m, cout);
+
+	return 0;
 }
-vector<string> cmd_mov(vector<string>& words) {
-	current_pos++;
 
-	if (words.size() != 3) return vector<string>();
-	if (words[2][0] == '!' || words[2] == "in") return vector<string>();
+// MPSIS -trace _file trace [DataIn] [max cycles]
+int trace(int argc, char** argv) {
+	if (argc < 4 || argc > 6) return -1;
 
+	vector<uint32_t> program;
+	if (!load_or_report(argv[2], program)) return -1;
 
-	if (words[1][0] == '!') {
-		bitset<4> to_wr = stoi(words[2]);
-		if (to_wr == 0 && words[0] != "") return vector<string>();
+	machine m;
+	if (argc > 4) m.in = stoi(argv[4]) & 15;
+	uint64_t max_cycles = argc > 5 ? stoull(argv[5]) : 1000000;
 
-		command cmd;
-		cmd.S = "0101";
-		cmd.wr = "1";
-		cmd.addr_wr = to_wr.to_string();
-		vector<command> cnst = cmd_const(words[1]);
-		return cmd_merge(cnst, cmd);
-	}
-	else if (words[1] == "in") {
-		bitset<4> to_wr = stoi(words[2]);
-		if (to_wr == 0 && words[0] != "") return vector<string>();
-
-		command cmd;
-		cmd.A = "1";
-		cmd.wr = "1";
-		cmd.v = "0001";
-		cmd.addr_wr = to_wr.to_string();
-
-		vector<string> result;
-		result.push_back(cmd.result());
-		return result;
-	}
-	else {
-		bitset<4> to_rd = stoi(words[1]);
-		bitset<4> to_wr = stoi(words[2]);
-		if (to_wr == 0 && words[0] != "") return vector<string>();
-
-		command cmd;
-		cmd.wr = "1";
-		cmd.v = "0001";
-		cmd.addr_wr = to_rd.to_string();
-		cmd.addr_wr = to_wr.to_string();
-
-		vector<string> result;
-		result.push_back(cmd.result());
-		return result;
+	if (!sim_trace(m, program, max_cycles, argv[3])) {
+		cout << "Can't write '" << argv[3] << "'" << endl;
+		return -1;
 	}
+	sim_print(m, cout);
+
+	return 0;
 }
-vector<string> cmd_add(vector<string>& words) {
-	current_pos++;
-
-	if (words.size() != 4) return vector<string>();
-	if (words[3][0] == '!' || words[3] == "in") return vector<string>();
-	
-	if (words[1][0] == '!') {
-		if (words[2][0] == '!') {
-			// Const + Const -> too lazy :)
-			return vector<string>();
-		}
-		else if (words[2] == "in") {
-			// Const + DataIn
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "1001";
-			cmd.M = "1";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> cnst = cmd_const(words[1]);
-			return cmd_merge(cnst, cmd);
-		}
-		else {
-			// Const + Addr
-			bitset<4> to_rd = stoi(words[2]);
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_rd == 0 || to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "1001";
-			cmd.M = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> cnst = cmd_const(words[1]);
-			return cmd_merge(cnst, cmd);
+
+// Assembler pipeline: reader -> tokenizer -> encoder, then passes and jump fixup as the final barrier
+
+const size_t BATCH_LINES = 256;
+const size_t READ_BLOCK = 1 << 20;
+const size_t WRITE_CHUNK = 1 << 16;
+
+class source_line {
+public:
+	int line_no;
+	vector<string> words;
+};
+
+typedef vector<string> line_batch;
+typedef vector<source_line> token_batch;
+typedef spsc_queue<line_batch, 64> line_queue;
+typedef spsc_queue<token_batch, 64> token_queue;
+
+// Whole lines in batches, an empty batch ends the stream
+void read_stage(ifstream& fin, line_queue& out, atomic<bool>& cancel) {
+	vector<char> block(READ_BLOCK);
+	string partial;
+	line_batch batch;
+
+	while (fin) {
+		fin.read(block.data(), block.size());
+		size_t got = (size_t)fin.gcount();
+		const char* p = block.data();
+		const char* end = p + got;
+
+		const char* eol;
+		while ((eol = (const char*)memchr(p, '\n', end - p)) != nullptr) {
+			partial.append(p, eol - p);
+			batch.push_back(move(partial));
+			partial.clear();
+			p = eol + 1;
+
+			if (batch.size() == BATCH_LINES) {
+				if (!out.push_wait(batch, cancel)) return;
+				batch.clear();
+			}
 		}
+		partial.append(p, end - p);
 	}
-	else if (words[1] == "in") {
-		if (words[2][0] == '!') {
-			// DataIn + Const
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "1001";
-			cmd.M = "1";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-
-			vector<command> cnst = cmd_const(words[2]);
-			return cmd_merge(cnst, cmd);
-		}
-		else if (words[2] == "in") {
-			// DataIn + DataIn
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "1001";
-			cmd.M = "1";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<string> _mov = { "", words[1], "0" };
-
-			vector<string> result = cmd_mov(_mov);
-			result.push_back(cmd.result());
-			return result;
+
+	// a last line without '\n' counts, like in microprogram<>
+	if (!partial.empty()) batch.push_back(move(partial));
+	if (!batch.empty() && !out.push_wait(batch, cancel)) return;
+	batch.clear();
+	out.push_wait(batch, cancel);
+}
+
+void tokenize_stage(line_queue& in, token_queue& out, atomic<bool>& cancel) {
+	int line_no = 0;
+	line_batch lines;
+
+	while (in.pop_wait(lines, cancel) && !lines.empty()) {
+		token_batch tokens;
+		for (string& line : lines) {
+			line_no++;
+
+			// same splitting as microprogram<>, '\r' counts as a space so CRLF and LF sources both work
+			string_view views[ENCODE_MAX_TOKENS];
+			size_t count = split_words(line, views);
+			if (count == 0) continue;
+
+			source_line sl;
+			sl.line_no = line_no;
+			if (count > ENCODE_MAX_TOKENS) sl.words.resize(count);		// too many, the encoder rejects it
+			else sl.words.assign(views, views + count);
+			tokens.push_back(move(sl));
 		}
-		else {
-			// DataIn + Addr
-			bitset<4> to_rd = stoi(words[2]);
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_rd == 0 || to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "1001";
-			cmd.M = "1";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0111";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-
-			vector<string> result;
-			result.push_back(cmd.result());
-			return result;
+		if (!tokens.empty() && !out.push_wait(tokens, cancel)) return;
+	}
+
+	token_batch done;
+	out.push_wait(done, cancel);
+}
+
+bool encode_stage(token_queue& in, vector<string>& program, atomic<bool>& cancel) {
+	token_batch tokens;
+
+	while (in.pop_wait(tokens, cancel) && !tokens.empty()) {
+		for (source_line& sl : tokens) {
+			vector<string> cmd = encode_words(sl.words);
+			if (cmd.size() == 0) return false;
+
+			program.insert(program.end(), cmd.begin(), cmd.end());
+			source_lines.insert(source_lines.end(), cmd.size(), sl.line_no);
 		}
 	}
-	else {
-		if (words[2][0] == '!') {
-			// Addr + Const
-			bitset<4> to_rd = stoi(words[1]);
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_rd == 0 || to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "1001";
-			cmd.M = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> cnst = cmd_const(words[2]);
-			return cmd_merge(cnst, cmd);
+	return true;
+}
+
+// Assembles the whole source and resolves jumps, message gets the reason of a failure
+bool assemble(ifstream& fin, vector<string>& program, string& message) {
+	if (!fin.is_open()) {
+		message = "Can't open the source";
+		return false;
+	}
+
+	line_queue lines;
+	token_queue tokens;
+	atomic<bool> cancel(false);
+
+	thread reader(read_stage, ref(fin), ref(lines), ref(cancel));
+	thread tokenizer(tokenize_stage, ref(lines), ref(tokens), ref(cancel));
+	bool ok = encode_stage(tokens, program, cancel);
+	if (!ok) cancel = true;
+	reader.join();
+	tokenizer.join();
+	if (!ok) return false;
+
+	drop_reloads(program);
+	apply_peephole(program);
+
+	for (auto const& kvp : jmps) {
+		int pos = kvp.first;
+		string label = kvp.second;
+		int dest = labels[label];
+		if (dest == 0) {
+			message = "Label '" + label + "' not found";
+			return false;
 		}
-		else if (words[2] == "in") {
-			// Addr + DataIn
-			bitset<4> to_rd = stoi(words[1]);
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_rd == 0 || to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "1001";
-			cmd.M = "1";
-			cmd.wr = "1";
-			cmd.v = "0111";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<string> result;
-			result.push_back(cmd.result());
-			return result;
+		dest--;
+		if (dest > (int)JUMP_DEST_MAX) {
+			message = "Label '" + label + "' out of jump range";
+			return false;
 		}
-		else {
-			// Addr + Addr
-			bitset<4> to_rd = stoi(words[1]);
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_rd == 0 || to_wr == 0 || stoi(words[2]) == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "1001";
-			cmd.M = "1";
-			cmd.wr = "1";
-			cmd.v = "0110";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<string> result = cmd_lda(words[2]);
-			result.push_back(cmd.result());
-			return result;
+		bitset<8> _dest = dest;
+
+		program[pos] += _dest.to_string();
+	}
+
+	return true;
+}
+
+// Writer stage: lines are packed into chunks here while a thread writes them out
+void write_program(ofstream& fout, const vector<string>& program) {
+	spsc_queue<string, 16> chunks;
+	atomic<bool> cancel(false);
+
+	thread writer([&]() {
+		string chunk;
+		while (chunks.pop_wait(chunk, cancel) && !chunk.empty()) fout.write(chunk.data(), chunk.size());
+	});
+
+	string chunk;
+	for (const string& line : program) {
+		chunk += line;
+		chunk += '\n';
+		if (chunk.size() >= WRITE_CHUNK) {
+			chunks.push_wait(chunk, cancel);
+			chunk.clear();
 		}
 	}
+	if (!chunk.empty()) chunks.push_wait(chunk, cancel);
+	chunk.clear();
+	chunks.push_wait(chunk, cancel);
+	writer.join();
+	fout.flush();
 }
-vector<string> cmd_sub(vector<string>& words) {
-	current_pos++;
 
-	if (words.size() != 4) return vector<string>();
-	if (words[3][0] == '!' || words[3] == "in") return vector<string>();
+// Assembles a source in-process for the modes that report by source line
+bool assemble_file(const char* path, vector<uint32_t>& words) {
+	ifstream fin(path, ifstream::binary);
+	if (!fin.is_open()) {
+		cout << "Can't open '" << path << "'" << endl;
+		return false;
+	}
 
-	// to lazy making Const - Smth :<
-	if (words[1][0] == '!') {
-		return vector<string>();
-		if (words[2][0] == '!') {
-			// Const - Const -> lazy again :P
-		}
-		else if (words[2] == "in") {
-			// Const - DataIn
+	vector<string> program;
+	string message;
+	if (!assemble(fin, program, message)) {
+		cout << (message.empty() ? "Error" : message) << endl;
+		return false;
+	}
+
+	words.assign(program.size(), 0);
+	for (size_t i = 0; i < program.size(); i++) {
+		if (!program[i].empty()) pack_word(program[i].c_str(), program[i].length(), words[i]);
+	}
+	return true;
+}
+
+// Streaming assembler: words go out as they are encoded, only forward jumps wait for their label
+// Text words are 25 chars, binary words 4 bytes little endian after BINARY_MAGIC, so a jump destination is patched in place
+
+const size_t PATCH_BATCH = 1 << 16;
+
+class stream_output {
+public:
+	stream_output(ofstream& fout, bool binary) : fout(fout), binary(binary) {
+		if (binary) chunk.append(BINARY_MAGIC, 4);
+	}
+
+	// Label slots are empty lines or zero words
+	void word(uint32_t bits, bool slot) {
+		if (!binary) {
+			if (!slot) chunk += bitset<25>(bits).to_string();
+			chunk += '\n';
 		}
 		else {
-			// Const - Addr
+			for (int i = 0; i < 4; i++) chunk += (char)(bits >> (i * 8));
 		}
+		if (chunk.size() >= WRITE_CHUNK) flush();
 	}
-	else if (words[1] == "in") {
-		if (words[2][0] == '!') {
-			// DataIn - Const
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "0110";
-			cmd.M = "1";
-			cmd.P0 = "1";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> _const = cmd_const(words[2]);
-			return cmd_merge(_const, cmd);
-		}
-		else if (words[2] == "in") {
-			// 4 steps :<
-			return vector<string>();
-			// DataIn - DataIn
-			//bitset<4> to_wr = stoi(words[3]);
-			//if (to_wr == 0) return vector<string>();
-
-			//command cmd;
-			//cmd.S = "0110";
-			//cmd.M = "1";
-			//cmd.P0 = "1";
-			//cmd.A = "1";
-			//cmd.wr = "1";
-			//cmd.v = "0111";
-			//cmd.addr_wr = to_wr.to_string();
-
-			//vector<string> buff = { "", words[2], "0" };
-			//return cmd_mov(buff) + "\n" + cmd.result();
-		}
+
+	// Returns the offset of the destination field
+	uint64_t jump(uint32_t bits) {
+		uint64_t offset = written + chunk.size() + (binary ? 0 : 17);
+		word(bits, false);
+		return offset;
+	}
+
+	void patch(uint64_t offset, uint32_t dest) {
+		if (offset >= written) put(&chunk[offset - written], dest);
 		else {
-			// DataIn - Addr
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "0110";
-			cmd.M = "1";
-			cmd.P0 = "1";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> _const = cmd_const(words[2]);
-			return cmd_merge(_const, cmd);
+			patches.push_back(make_pair(offset, dest));
+			if (patches.size() >= PATCH_BATCH) apply();
 		}
 	}
-	else {
-		if (words[2][0] == '!') {
-			// Addr - Const
-			bitset<4> to_rd = stoi(words[1]);
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_rd == 0 || to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "0110";
-			cmd.M = "1";
-			cmd.P0 = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> _const = cmd_const(words[2]);
-			return cmd_merge(_const, cmd);
 
+	void finish() {
+		apply();
+		fout.flush();
+	}
+
+private:
+	ofstream& fout;
+	bool binary;
+	string chunk;
+	uint64_t written = 0;
+	vector<pair<uint64_t, uint32_t>> patches;
+
+	void put(char* field, uint32_t dest) {
+		if (binary) field[0] = (char)dest;
+		else memcpy(field, bitset<8>(dest).to_string().c_str(), 8);
+	}
+
+	void flush() {
+		fout.write(chunk.data(), chunk.size());
+		written += chunk.size();
+		chunk.clear();
+	}
+
+	// in file order, one seek per patch
+	void apply() {
+		flush();
+		sort(patches.begin(), patches.end());
+		char field[8];
+		size_t length = binary ? 1 : 8;
+		for (auto const& p : patches) {
+			put(field, p.second);
+			fout.seekp((streamoff)p.first);
+			fout.write(field, length);
 		}
-		else if (words[2] == "in") {
-			// Addr - DataIn -> sub
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_wr == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "0110";
-			cmd.M = "1";
-			cmd.P0 = "1";
-			cmd.wr = "1";
-			cmd.v = "0110";
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<string> _mov = { "" , words[2], "0" };
-
-			vector<string> result = cmd_mov(_mov);
-			vector<string> _lda = cmd_lda(words[1]);
-			result.insert(result.begin(), _lda.begin(), _lda.end());
-			return result;
-		}
-		else {
-			// Addr - Addr
-			bitset<4> to_rd = stoi(words[2]);
-			bitset<4> to_wr = stoi(words[3]);
-			if (to_rd == 0 || to_wr == 0 || stoi(words[1]) == 0) return vector<string>();
-
-			command cmd;
-			cmd.S = "0110";
-			cmd.M = "1";
-			cmd.P0 = "1";
-			cmd.wr = "1";
-			cmd.v = "0110";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<string> result = cmd_lda(words[1]);
-			result.push_back(cmd.result());
-			return result;
+		fout.seekp((streamoff)written);
+		patches.clear();
+	}
+};
+
+// Labels stay for backward jumps, forward jumps keep their field offsets until the label shows up
+bool stream_stage(token_queue& in, stream_output& out, atomic<bool>& cancel, string& message) {
+	map<string, uint32_t> defined;
+	map<string, vector<uint64_t>> pending;
+	token_batch tokens;
+	string_view views[ENCODE_MAX_TOKENS];
+
+	while (in.pop_wait(tokens, cancel) && !tokens.empty()) {
+		for (source_line& sl : tokens) {
+			if (sl.words.size() > ENCODE_MAX_TOKENS) return false;
+			for (size_t i = 0; i < sl.words.size(); i++) views[i] = sl.words[i];
+
+			encoded_line line = encode_line(views, sl.words.size());
+			if (line.count == 0) return false;
+
+			for (size_t k = 0; k < line.count; k++) {
+				const encoded_word& word = line.words[k];
+				if (word.kind == WORD_LABEL) {
+					// the whole-program assemblers let the last definition win, which a stream can't know yet
+					string label(line.label);
+					if (!defined.emplace(label, current_pos).second) {
+						message = "Label '" + label + "' defined twice";
+						return false;
+					}
+					auto it = pending.find(label);
+					if (it != pending.end()) {
+						if ((uint32_t)current_pos > JUMP_DEST_MAX) {
+							message = "Label '" + label + "' out of jump range";
+							return false;
+						}
+						for (uint64_t offset : it->second) out.patch(offset, current_pos);
+						pending.erase(it);
+					}
+					out.word(0, true);
+				}
+				else if (word.kind == WORD_JUMP) {
+					string label(line.label);
+					auto it = defined.find(label);
+					if (it == defined.end()) pending[label].push_back(out.jump(word.bits));
+					else if (it->second > JUMP_DEST_MAX) {
+						message = "Label '" + label + "' out of jump range";
+						return false;
+					}
+					else out.word(word.bits | it->second, false);
+				}
+				else out.word(word.bits, false);
+				current_pos++;
+			}
 		}
 	}
+
+	// the first unresolved jump, as the whole-program assembler reports it
+	auto first = pending.end();
+	for (auto it = pending.begin(); it != pending.end(); ++it) {
+		if (first == pending.end() || it->second[0] < first->second[0]) first = it;
+	}
+	if (first != pending.end()) {
+		message = "Label '" + first->first + "' not found";
+		return false;
+	}
+	out.finish();
+	return true;
 }
-vector<string> cmd_shr(vector<string>& words) {
-	current_pos++;
 
-	if (words.size() != 4) return vector<string>();
-	if (words[1][0] == '!' || words[3][0] == '!' || words[1] == "in" || words[3] == "in") return vector<string>();
+// MPSIS -wcet file
+int wcet(int argc, char** argv) {
+	if (argc != 3) return -1;
 
-	bitset<4> to_wr = stoi(words[3]);
-	if (to_wr == 0) return vector<string>();
+	vector<uint32_t> words;
+	if (!assemble_file(argv[2], words)) return -1;
 
-	command cmd;
-	cmd.S = "0101";
-	cmd.wr = "1";
-	cmd.v = "0100";
-	cmd.addr_wr = to_wr.to_string();
-	if (words[2] == "1") cmd.in_shift = "10";
-	else if (words[2] != "0") return vector<string>();
+	vector<int> targets(words.size(), -1);
+	for (auto const& kvp : jmps) targets[kvp.first] = labels[kvp.second] - 1;
 
-	vector<string> result = cmd_ldb(words[1]);
-	result.push_back(cmd.result());
-	return result;
+	wcet_report(words, targets, source_lines, labels, bounds, argv[2], cout);
+	return 0;
 }
-vector<string> cmd_shl(vector<string>& words) {
-	current_pos++;
 
-	if (words.size() != 4) return vector<string>();
-	if (words[1][0] == '!' || words[3][0] == '!' || words[1] == "in" || words[3] == "in") return vector<string>();
+// MPSIS -superopt _file [window] [table]
+int superopt(int argc, char** argv) {
+	if (argc < 3 || argc > 5) return -1;
 
-	bitset<4> to_wr = stoi(words[3]);
-	if (to_wr == 0) return vector<string>();
+	vector<uint32_t> program;
+	if (!load_or_report(argv[2], program)) return -1;
 
-	command cmd;
-	cmd.S = "0101";
-	cmd.wr = "1";
-	cmd.v = "0010";
-	cmd.addr_wr = to_wr.to_string();
-	if (words[2] == "1") cmd.in_shift = "01";
-	else if (words[2] != "0") return vector<string>();
+	int max_window = argc > 3 ? stoi(argv[3]) : 3;
+	const char* path = argc > 4 ? argv[4] : PEEPHOLE_TABLE;
+	peephole_table table;
+	load_peephole(path, table);
 
-	vector<string> result = cmd_ldb(words[1]);
-	result.push_back(cmd.result());
-	return result;
+	int rules = superoptimize(program, max_window, table, cout);
+	if (!save_peephole(path, table)) {
+		cout << "Can't write '" << path << "'" << endl;
+		return -1;
+	}
+	cout << rules << " new rules" << endl;
+
+	return 0;
 }
-//string cmd_inc(vector<string>& words) {
-//	if (line[3] != ' ') return vector<string>();
-//	string result = "000";
-//	return result;
-//}
-//string cmd_dec(vector<string>& words) {
-//	if (line[3] != ' ') return vector<string>();
-//	string result = "000";
-//	return result;
-//}
-vector<string> cmd_and(vector<string>& words) {
-	current_pos++;
-
-	if (words.size() != 4) return vector<string>();
-	bitset<4> to_wr = stoi(words[3]);
-	if (to_wr == 0) return vector<string>();
-	command cmd;
-
-	if (words[1][0] == '!') {
-		if (words[1][0] == '!') {
-			return vector<string>();
-
-			// Const & Const
-			//vector<string> _mov = { "", words[1], "0" };
-		}
-		else if (words[1] == "in") {
-			// Const & DataIn
-			cmd.S = "0100";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> _const = cmd_const(words[1]);
-			return cmd_merge(_const, cmd);
-		}
-		else {
-			// Const & Addr
-			bitset<4> to_rd = stoi(words[2]);
-			if (to_rd == 0) return vector<string>();
-
-			cmd.S = "0100";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> _const = cmd_const(words[1]);
-			return cmd_merge(_const, cmd);
-		}
+
+// MPSIS -dump trace [lo hi] | MPSIS -dump trace file label
+int dump(int argc, char** argv) {
+	if (argc != 3 && argc != 5) return -1;
+
+	uint32_t lo = 0;
+	uint32_t hi = UINT32_MAX;
+	if (argc == 5 && string(argv[3]).find_first_not_of("0123456789") == string::npos) {
+		lo = stoul(argv[3]);
+		hi = stoul(argv[4]);
 	}
-	else if (words[1] == "in") {
-		if (words[1][0] == '!') {
-			// DataIn & Const -> mov then and
-			cmd.S = "0100";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> _const = cmd_const(words[2]);
-			return cmd_merge(_const, cmd);
+	else if (argc == 5) {
+		// label range runs up to the next label slot
+		load_peephole(PEEPHOLE_TABLE, peephole);
+		ifstream fin(argv[3], ifstream::binary);
+		vector<string> program;
+		string message;
+		if (!assemble(fin, program, message)) {
+			cout << (message.empty() ? "Error" : message) << endl;
+			return -1;
 		}
-		else if (words[1] == "in") {
-			// DataIn & DataIn
-			cmd.S = "0100";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0111";
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<string> _mov = { "", words[1], "0" };
-
-			vector<string> result = cmd_mov(_mov);
-			result.push_back(cmd.result());
-			return result;
+		auto it = labels.find(argv[4]);
+		if (it == labels.end()) {
+			cout << "Label '" << argv[4] << "' not found" << endl;
+			return -1;
 		}
-		else {
-			// DataIn & Addr -> and
-			bitset<4> to_rd = stoi(words[2]);
-			if (to_rd == 0) return vector<string>();
-
-			cmd.S = "0100";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0111";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<string> _mov = { "", words[1], "0" };
-
-			vector<string> result = cmd_mov(_mov);
-			result.push_back(cmd.result());
-			return result;
+		lo = it->second - 1;
+		hi = (uint32_t)program.size() - 1;
+		for (auto const& kvp : labels) {
+			uint32_t slot = kvp.second - 1;
+			if (slot > lo && slot <= hi) hi = slot - 1;
 		}
 	}
-	else {
-		if (words[1][0] == '!') {
-			// Addr & Const
-			bitset<4> to_rd = stoi(words[1]);
-			if (to_rd == 0) return vector<string>();
-
-			cmd.S = "0100";
-			cmd.wr = "1";
-			cmd.v = "0001";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<command> _const = cmd_const(words[2]);
-			return cmd_merge(_const, cmd);
-		}
-		else if (words[1] == "in") {
-			// Addr & DataIn
-			bitset<4> to_rd = stoi(words[1]);
-			if (to_rd == 0) return vector<string>();
-
-			cmd.S = "0100";
-			cmd.A = "1";
-			cmd.wr = "1";
-			cmd.v = "0111";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<string> _mov = { "", words[2], "0" };
-
-			vector<string> result = cmd_mov(_mov);
-			result.push_back(cmd.result());
-			return result;
-		}
-		else {
-			// Addr & Addr
-			bitset<4> to_rd = stoi(words[1]);
-			if (to_rd == 0 || stoi(words[2]) == 0) return vector<string>();
-
-			cmd.S = "0100";
-			cmd.wr = "1";
-			cmd.v = "0110";
-			cmd.addr_rd = to_rd.to_string();
-			cmd.addr_wr = to_wr.to_string();
-
-			vector<string> result = cmd_lda(words[2]);
-			result.push_back(cmd.result());
-			return result;
-		}
+
+	if (!trace_dump(argv[2], lo, hi, cout)) {
+		cout << "Broken trace '" << argv[2] << "'" << endl;
+		return -1;
 	}
+	return 0;
 }
-//string cmd_or(vector<string>& words) {
-//	if (words.size() != 4) return vector<string>();
-//	string result = "00000010000111110";
-//	bitset<4> in, one, two;
-//	if (words[1][0] == '!') {
-//		if (words[1][0] == '!') {
-//			// Const & Const -> mov then or
-//			vector<string> buff = { "", words[1], "0" };
-//			result = cmd_mov(buff) + "\n" + result;
-//			in = atoi(words[2].c_str() + 1);
-//			one = 0;
-//		}
-//		else if (words[1] == "in") {
-//			// Const & DataIn -> mov then or
-//			vector<string> buff = { "", words[2], "0" };
-//			result = cmd_mov(buff) + "\n" + result;
-//			in = atoi(words[1].c_str() + 1);
-//			one = 0;
-//		}
-//		else {
-//			// Const & Addr -> or
-//			in = atoi(words[1].c_str() + 1);
-//			one = stoi(words[2]);
-//			if (one == 0) return vector<string>();
-//		}
-//	}
-//	else if (words[1] == "in") {
-//		if (words[1][0] == '!') {
-//			// DataIn & Const -> mov then or
-//			result[16] = '1';
-//			vector<string> buff = { "", words[2], "0" };
-//			result = cmd_mov(buff) + "\n" + result;
-//			in = 0;
-//			one = 0;
-//		}
-//		else if (words[1] == "in") {
-//			// DataIn & DataIn -> mov then or
-//			result[16] = '1';
-//			vector<string> buff = { "", words[2], "0" };
-//			result = cmd_mov(buff) + "\n" + result;
-//			in = 0;
-//			one = 0;
-//		}
-//		else {
-//			// DataIn & Addr -> or
-//			result[16] = '1';
-//			in = 0;
-//			one = stoi(words[2]);
-//		}
-//	}
-//	else {
-//		if (words[1][0] == '!') {
-//			// Addr & Const -> or
-//			in = atoi(words[2].c_str() + 1);
-//			one = stoi(words[2]);
-//			if (one == 0) return vector<string>();
-//		}
-//		else if (words[1] == "in") {
-//			// Addr & DataIn -> or
-//			result[16] = '1';
-//			one = stoi(words[2]);
-//			if (one == 0) return vector<string>();
-//		}
-//		else {
-//			// Addr & Addr -> ld then or
-//			result[11] = '0';
-//			result[15] = '0';
-//			if (stoi(words[2]) == 0) return vector<string>();
-//			result = cmd_lda(words[2]) + "\n" + result;
-//			in = 0;
-//			one = stoi(words[1]);
-//			if (one == 0) return vector<string>();
-//		}
-//	}
-//	two = stoi(words[3]);
-//	if (two == 0) return vector<string>();
-//	return result + in.to_string() + one.to_string() + two.to_string();
-//}
-//string cmd_xor(vector<string>& words) {
-//	if (words.size() != 4) return vector<string>();
-//	string result = "00010010000111110";
-//	bitset<4> in, one, two;
-//	if (words[1][0] == '!') {
-//		if (words[1][0] == '!') {
-//			// Const & Const -> mov then xor
-//			vector<string> buff = { "", words[1], "0" };
-//			result = cmd_mov(buff) + "\n" + result;
-//			in = atoi(words[2].c_str() + 1);
-//			one = 0;
-//		}
-//		else if (words[1] == "in") {
-//			// Const & DataIn -> mov then xor
-//			vector<string> buff = { "", words[2], "0" };
-//			result = cmd_mov(buff) + "\n" + result;
-//			in = atoi(words[1].c_str() + 1);
-//			one = 0;
-//		}
-//		else {
-//			// Const & Addr -> xor
-//			in = atoi(words[1].c_str() + 1);
-//			one = stoi(words[2]);
-//			if (one == 0) return vector<string>();
-//		}
-//	}
-//	else if (words[1] == "in") {
-//		if (words[1][0] == '!') {
-//			// DataIn & Const -> mov then xor
-//			result[16] = '1';
-//			vector<string> buff = { "", words[2], "0" };
-//			result = cmd_mov(buff) + "\n" + result;
-//			in = 0;
-//			one = 0;
-//		}
-//		else if (words[1] == "in") {
-//			// DataIn & DataIn -> mov then xor
-//			result[16] = '1';
-//			vector<string> buff = { "", words[2], "0" };
-//			result = cmd_mov(buff) + "\n" + result;
-//			in = 0;
-//			one = 0;
-//		}
-//		else {
-//			// DataIn & Addr -> xor
-//			result[16] = '1';
-//			in = 0;
-//			one = stoi(words[2]);
-//		}
-//	}
-//	else {
-//		if (words[1][0] == '!') {
-//			// Addr & Const -> xor
-//			in = atoi(words[2].c_str() + 1);
-//			one = stoi(words[2]);
-//			if (one == 0) return vector<string>();
-//		}
-//		else if (words[1] == "in") {
-//			// Addr & DataIn -> xor
-//			result[16] = '1';
-//			one = stoi(words[2]);
-//			if (one == 0) return vector<string>();
-//		}
-//		else {
-//			// Addr & Addr -> ld then xor
-//			result[11] = '0';
-//			result[15] = '0';
-//			if (stoi(words[2]) == 0) return vector<string>();
-//			result = cmd_lda(words[2]) + "\n" + result;
-//			in = 0;
-//			one = stoi(words[1]);
-//			if (one == 0) return vector<string>();
-//		}
-//	}
-//	two = stoi(words[3]);
-//	if (two == 0) return vector<string>();
-//	return result + in.to_string() + one.to_string() + two.to_string();
-//}
-vector<string> cmd_not(vector<string>& words) {
-	current_pos++;
-
-	if (words.size() != 3) return vector<string>();
-	if (words[2][0] == '!' || words[2] == "in") return vector<string>();
-
-	bitset<4> to_wr = stoi(words[2]);
-	if (to_wr == 0) return vector<string>();
-
-	if (words[1][0] == '!') {
-
-		command cmd;
-		cmd.S = "1010";
-		cmd.wr = "1";
-		cmd.v = "0000";
-		cmd.addr_wr = to_wr.to_string();
-
-		vector<command> _const = cmd_const(words[1]);
-		return cmd_merge(_const, cmd);
-	}
-	else if (words[1] == "in") {
-		command cmd;
-		cmd.S = "1111";
-		cmd.A = "1";
-		cmd.wr = "1";
-		cmd.v = "0001";
-		cmd.addr_wr = to_wr.to_string();
-
-		vector<string> result;
-		result.push_back(cmd.result());
-		return result;
-	}
-	else {
-		command cmd;
-		cmd.S = "1111";
-		cmd.wr = "1";
-		cmd.v = "0001";
-		cmd.addr_wr = to_wr.to_string();
-
-		vector<string> result;
-		result.push_back(cmd.result());
-		return result;
+
+// MPSIS -cosim network [cycles] [quantum]
+int cosim(int argc, char** argv) {
+	if (argc < 3 || argc > 5) return -1;
+
+	uint64_t max_cycles = argc > 3 ? stoull(argv[3]) : 1000000;
+	uint32_t quantum = argc > 4 ? stoul(argv[4]) : 4096;
+	return cosim_run(argv[2], max_cycles, quantum, cout) ? 0 : -1;
+}
+
+// MPSIS -shm _file name [max cycles]
+int shm(int argc, char** argv) {
+	if (argc < 4 || argc > 5) return -1;
+
+	vector<uint32_t> program;
+	if (!load_or_report(argv[2], program)) return -1;
+
+	shared_segment segment;
+	if (!segment.create(argv[3])) {
+		cout << "Can't create shared memory '" << argv[3] << "'" << endl;
+		return -1;
 	}
+
+	machine m;
+	uint64_t max_cycles = argc > 4 ? stoull(argv[4]) : UINT64_MAX;
+	sim_shared(m, program, max_cycles, *segment.ports);
+	sim_print(m, cout);
+
+	return 0;
 }
-vector<string> cmd_out(vector<string>& words) {
-	current_pos++;
 
-	if (words.size() != 3) return vector<string>();
-	if (words[2] == "in" || words[2][0] == '!') return vector<string>();
+// MPSIS -debug _file [DataIn] [history MB]
+int debug(int argc, char** argv) {
+	if (argc < 3 || argc > 5) return -1;
 
-	bitset<2> to_out = stoi(words[2]);
-	command cmd;
+	vector<uint32_t> program;
+	if (!load_or_report(argv[2], program)) return -1;
 
-	if (words[1] == "in") {
-		cmd.A = "1";
-		cmd.v = "1001";
-		cmd.addr_wr = "00" + to_out.to_string();
+	machine m;
+	if (argc > 3) m.in = stoi(argv[3]) & 15;
+	size_t budget = (argc > 4 ? stoull(argv[4]) : 256) << 20;
 
-		vector<string> result;
-		result.push_back(cmd.result());
-		return result;
-	}
-	else if (words[1][0] == '!') {
-		cmd.S = "0101";
-		cmd.v = "1000";
-		cmd.addr_wr = "00" + to_out.to_string();
+	debugger dbg(program, m, budget);
+	debug_session(dbg, cin, cout);
 
-		vector<command> _const = cmd_const(words[1]);
-		return cmd_merge(_const, cmd);
-	}
-	else {
-		cmd.v = "1001";
-		cmd.addr_wr = "00" + to_out.to_string();
+	return 0;
+}
+
+// MPSIS -timing file [config | -] [DataIn] [max cycles]
+int timing(int argc, char** argv) {
+	if (argc < 3 || argc > 6) return -1;
 
-		vector<string> result;
-		result.push_back(cmd.result());
-		return result;
+	timing_config config;
+	if (argc > 3 && string(argv[3]) != "-" && !config.load(argv[3])) {
+		cout << "Bad timing config '" << argv[3] << "'" << endl;
+		return -1;
 	}
+
+	vector<uint32_t> words;
+	if (!assemble_file(argv[2], words)) return -1;
+
+	machine m;
+	if (argc > 4) m.in = stoi(argv[4]) & 15;
+	uint64_t max_cycles = argc > 5 ? stoull(argv[5]) : 1000000;
+
+	timing_stats stats;
+	sim_timed(m, words, max_cycles, config, stats);
+	sim_print(m, cout);
+	cout << endl;
+	timing_report(stats, source_lines, argv[2], cout);
+
+	return 0;
 }
-vector<string> cmd_lbl(vector<string>& words) {
-	if (words.size() != 2) return vector<string>();
-	labels[words[1]] = current_pos + 1;
-	current_pos++;
-	vector<string> result;
-	result.push_back("\n");
-	return result;
+
+// MPSIS -aot _file out.cpp
+int aot(int argc, char** argv) {
+	if (argc != 4) return -1;
+
+	vector<uint32_t> program;
+	if (!load_or_report(argv[2], program)) return -1;
+
+	ofstream fout(argv[3], ofstream::binary | ofstream::trunc);
+	if (!fout.is_open()) {
+		cout << "Can't write '" << argv[3] << "'" << endl;
+		return -1;
+	}
+	translate_program(program, argv[2], fout);
+
+	return 0;
 }
 
-int error(ifstream& fin, ofstream& fout) {
-	fout << "Error" << endl;
+// MPSIS -stream file [bin]
+// No reload or peephole passes, memory grows with labels and pending forward jumps only
+// A label may be defined once here
+int stream(int argc, char** argv) {
+	if (argc < 3 || argc > 4) return -1;
+	bool binary = argc > 3 && string(argv[3]) == "bin";
+
+	ifstream fin(argv[2], ifstream::binary);
+	ofstream fout(string("_") + argv[2], ofstream::binary | ofstream::trunc);
+	if (!fin.is_open()) {
+		fout << "Can't open the source" << endl;
+		return error(fin, fout);
+	}
+	stream_output out(fout, binary);
+
+	line_queue lines;
+	token_queue tokens;
+	atomic<bool> cancel(false);
+	string message;
+
+	thread reader(read_stage, ref(fin), ref(lines), ref(cancel));
+	thread tokenizer(tokenize_stage, ref(lines), ref(tokens), ref(cancel));
+	bool ok = stream_stage(tokens, out, cancel, message);
+	if (!ok) cancel = true;
+	reader.join();
+	tokenizer.join();
+
+	if (!ok) {
+		fout.close();
+		fout.open(string("_") + argv[2], ofstream::binary | ofstream::trunc);
+		if (!message.empty()) fout << message << endl;
+		return error(fin, fout);
+	}
+
 	fin.close();
 	fout.close();
-	return -1;
+
+	cout << current_pos << endl;
+
+	return 0;
 }
 
 int main(int argc, char** argv) {
+	if (argc > 1 && string(argv[1]) == "-run") return run(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-superopt") return superopt(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-trace") return trace(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-dump") return dump(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-cosim") return cosim(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-shm") return shm(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-debug") return debug(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-aot") return aot(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-stream") return stream(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-wcet") {
+		load_peephole(PEEPHOLE_TABLE, peephole);
+		return wcet(argc, argv);
+	}
+	if (argc > 1 && string(argv[1]) == "-timing") {
+		load_peephole(PEEPHOLE_TABLE, peephole);
+		return timing(argc, argv);
+	}
 	if (argc != 2) return -1;
 
-	commands["nop"] = cmd_nop;
-	commands["jne"] = cmd_jne;
-	commands["jg"] = cmd_jg;
-	commands["jl"] = cmd_jl;
-	commands["je"] = cmd_je;
-	commands["jge"] = cmd_jge;
-	commands["jle"] = cmd_jle;
-	commands["jmp"] = cmd_jmp;
-	commands["mov"] = cmd_mov;
-	commands["add"] = cmd_add;
-	commands["sub"] = cmd_sub;
-	commands["shr"] = cmd_shr;
-	commands["shl"] = cmd_shl;
-	//commands["inc"] = cmd_inc;
-	//commands["dec"] = cmd_dec;
-	commands["and"] = cmd_and;
-	//commands["or"] = cmd_or;
-	//commands["xor"] = cmd_xor;
-	commands["not"] = cmd_not;
-	commands["out"] = cmd_out;
-	commands["lbl"] = cmd_lbl;
+	load_peephole(PEEPHOLE_TABLE, peephole);
 
 	ifstream fin(argv[1], ifstream::binary);
 	ofstream fout(string("_") + argv[1], ofstream::binary | ofstream::trunc);
 
 	vector<string> program;
-
-	while (true) {
-		char buffer[128];
-
-		fin.getline(buffer, 128);
-		if (fin.eof()) break;
-		if (buffer[0] == '\r') continue;
-
-		string line(buffer);
-		vector<string> command = break_word(line);
-		vector<string> (*func)(vector<string>&) = commands[command[0]];
-		if (func == 0) return error(fin, fout);
-		
-		vector<string> cmd = func(command);
-		if (cmd.size() == 0) return error(fin, fout);
-
-		program.insert(program.end(), cmd.begin(), cmd.end());
-	}
-
-	for (auto const& kvp : jmps) {
-		int pos = kvp.first;
-		string label = kvp.second;
-		int dest = labels[label];
-		if (dest == 0) {
-			fout << "Label '" << label << "' not found" << endl;
-			return error(fin, fout);
-		}
-		dest--;
-		bitset<8> _dest = dest;
-
-		program[pos] += _dest.to_string();
+	string message;
+	if (!assemble(fin, program, message)) {
+		if (!message.empty()) fout << message << endl;
+		return error(fin, fout);
 	}
-	for (string line : program) fout << line << endl;
+	write_program(fout, program);
 
 	fin.close();
 	fout.close();
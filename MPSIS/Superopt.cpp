@@ -0,0 +1,213 @@
+#include "Superopt.h"
+#include "Simulator.h"
+#include <atomic>
+#include <bitset>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <set>
+#include <thread>
+
+using namespace std;
+
+const int TESTS = 32;
+const uint64_t MAX_EXHAUSTIVE = 1ull << 26;
+
+bool load_peephole(const char* path, peephole_table& table) {
+	ifstream fin(path, ifstream::binary);
+	if (!fin.is_open()) return false;
+
+	string line;
+	while (getline(fin, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		size_t eq = line.find(" = ");
+		if (eq == string::npos) continue;
+		table[line.substr(0, eq)] = line.substr(eq + 3);
+	}
+	return true;
+}
+
+bool save_peephole(const char* path, const peephole_table& table) {
+	ofstream fout(path, ofstream::binary | ofstream::trunc);
+	if (!fout.is_open()) return false;
+
+	for (auto const& kvp : table) fout << kvp.first << " = " << kvp.second << endl;
+	return true;
+}
+
+static string word_string(uint32_t word) { return bitset<25>(word).to_string(); }
+
+// Register read by a word as a bit mask
+static uint32_t word_reads(uint32_t word) {
+	bool loads = (word & 0x100) || ((word >> 9) & 3) == 3;
+	return loads ? 1u << ((word >> 4) & 15) : 0;
+}
+
+static bool same_state(const machine& a, const machine& b) {
+	return memcmp(a.rf, b.rf, sizeof(a.rf)) == 0 && memcmp(a.out, b.out, sizeof(a.out)) == 0
+		&& a.ra == b.ra && a.rb == b.rb && a.z == b.z && a.c == b.c;
+}
+
+class window {
+public:
+	vector<uint32_t> words;
+	uint32_t reads = 0;
+	int write = -1;		// register written
+	int port = -1;		// out port strobed
+	int inputs = 0;		// words reading DataIn
+
+	// One word writes one register and one port through the same address
+	// Every strobe is a value on the port (-cosim, -shm), so at most one, and DataIn reads stay as many as the word has
+	bool analyse() {
+		for (uint32_t w : words) {
+			reads |= word_reads(w);
+			if (w & 0x1000) {
+				if (write != -1 && write != (int)(w & 15)) return false;
+				write = w & 15;
+			}
+			if (w & 0x800) {
+				if (port != -1) return false;
+				port = w & 3;
+			}
+			if (w & 0x2000) inputs++;
+		}
+		if (inputs > 1) return false;
+		return write == -1 || port == -1 || (write & 3) == port;
+	}
+
+	void run(machine& m) const {
+		for (uint32_t w : words) sim_step(m, w);
+	}
+};
+
+// Same final state for every value of DataIn, latches, flags and every register either side reads
+static bool prove(const window& win, uint32_t candidate, const machine& base) {
+	uint32_t reads = win.reads | word_reads(candidate);
+	int regs[16];
+	int count = 0;
+	for (int r = 0; r < 16; r++) if (reads & (1u << r)) regs[count++] = r;
+
+	int nibbles = 3 + count;
+	if (nibbles * 4 + 2 > 26) return false;
+	uint64_t space = 1ull << (nibbles * 4 + 2);
+	if (space > MAX_EXHAUSTIVE) return false;
+
+	for (uint64_t x = 0; x < space; x++) {
+		machine m = base;
+		uint64_t bits = x;
+		m.z = bits & 1;
+		m.c = (bits >> 1) & 1;
+		bits >>= 2;
+		m.in = bits & 15;
+		m.ra = (bits >> 4) & 15;
+		m.rb = (bits >> 8) & 15;
+		bits >>= 12;
+		for (int i = 0; i < count; i++, bits >>= 4) m.rf[regs[i]] = bits & 15;
+
+		machine c = m;
+		win.run(m);
+		sim_step(c, candidate);
+		if (!same_state(m, c)) return false;
+	}
+	return true;
+}
+
+// First proven single word equal to the window, 0 if none
+static uint32_t search(const window& win, const vector<machine>& tests, const vector<machine>& expected) {
+	uint32_t fixed = 0;
+	if (win.write != -1) fixed |= 0x1000 | win.write;
+	if (win.port != -1) fixed |= 0x800 | (win.write != -1 ? 0 : win.port);
+
+	for (uint32_t s = 0; s < 16; s++)
+	for (uint32_t mode = 0; mode < 2; mode++)
+	for (uint32_t p0 = 0; p0 < 2; p0++)
+	for (uint32_t a = win.inputs; a <= (uint32_t)win.inputs; a++)
+	for (uint32_t latch = 0; latch < 8; latch++) {
+		uint32_t rb_op = latch >> 1;		// 1 shift left, 2 shift right, 3 load
+		bool loads = (latch & 1) || rb_op == 3;
+		uint32_t shift_bit = rb_op == 1 ? 0x4000 : rb_op == 2 ? 0x8000 : 0;
+
+		for (uint32_t rd = 0; rd < (loads ? 16u : 1u); rd++)
+		for (uint32_t in = 0; in < (shift_bit ? 2u : 1u); in++) {
+			uint32_t candidate = fixed | (s << 18) | (mode << 17) | (p0 << 16) | (a << 13)
+				| (rb_op << 9) | ((latch & 1) << 8) | (rd << 4) | (in ? shift_bit : 0);
+
+			bool equal = true;
+			for (size_t t = 0; t < tests.size() && equal; t++) {
+				machine m = tests[t];
+				sim_step(m, candidate);
+				equal = same_state(m, expected[t]);
+			}
+			if (equal && prove(win, candidate, tests[0])) return candidate;
+		}
+	}
+	return 0;
+}
+
+static string window_key(const vector<uint32_t>& words) {
+	string key;
+	for (uint32_t w : words) {
+		if (!key.empty()) key += ' ';
+		key += word_string(w);
+	}
+	return key;
+}
+
+int superoptimize(const vector<uint32_t>& program, int max_window, peephole_table& table, ostream& log) {
+	// zero words may be label slots and jumps leave the window, both end it
+	set<vector<uint32_t>> seen;
+	vector<window> jobs;
+	for (size_t i = 0; i < program.size(); i++) {
+		for (size_t len = 2; len <= (size_t)max_window && i + len <= program.size(); len++) {
+			uint32_t last = program[i + len - 1];
+			if (program[i] == 0 || (program[i] >> 22) || last == 0 || (last >> 22)) break;
+
+			window win;
+			win.words.assign(program.begin() + i, program.begin() + i + len);
+			if (!seen.insert(win.words).second) continue;
+			if (table.count(window_key(win.words))) continue;
+			if (win.analyse()) jobs.push_back(win);
+		}
+	}
+
+	mt19937 rng(25);
+	vector<machine> tests(TESTS);
+	for (machine& m : tests) {
+		for (uint8_t& r : m.rf) r = rng() & 15;
+		for (uint8_t& o : m.out) o = rng() & 15;
+		m.ra = rng() & 15;
+		m.rb = rng() & 15;
+		m.in = rng() & 15;
+		m.z = rng() & 1;
+		m.c = rng() & 1;
+	}
+
+	vector<uint32_t> found(jobs.size(), 0);
+	atomic<size_t> next(0);
+	auto worker = [&]() {
+		vector<machine> expected(tests.size());
+		for (size_t j; (j = next++) < jobs.size();) {
+			for (size_t t = 0; t < tests.size(); t++) {
+				expected[t] = tests[t];
+				jobs[j].run(expected[t]);
+			}
+			found[j] = search(jobs[j], tests, expected);
+		}
+	};
+
+	unsigned threads = max(1u, thread::hardware_concurrency());
+	vector<thread> pool;
+	for (unsigned t = 1; t < threads; t++) pool.push_back(thread(worker));
+	worker();
+	for (thread& t : pool) t.join();
+
+	int rules = 0;
+	for (size_t j = 0; j < jobs.size(); j++) {
+		if (found[j] == 0) continue;
+		string key = window_key(jobs[j].words);
+		table[key] = word_string(found[j]);
+		log << key << " = " << table[key] << endl;
+		rules++;
+	}
+	return rules;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Peephole rules: words of a window joined by spaces -> one equivalent word
+typedef std::map<std::string, std::string> peephole_table;
+
+// Table the assembler picks up from the working directory
+#define PEEPHOLE_TABLE "peephole.txt"
+
+bool load_peephole(const char* path, peephole_table& table);
+bool save_peephole(const char* path, const peephole_table& table);
+
+// Searches windows of 2..max_window words for one equivalent word on all threads
+// Only rules proven on every relevant input state are added, returns their number
+int superoptimize(const std::vector<uint32_t>& program, int max_window, peephole_table& table, std::ostream& log);
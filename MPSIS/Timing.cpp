@@ -0,0 +1,125 @@
+#include "Timing.h"
+#include "Analyzer.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+static const char* const HAZARD_NAMES[HAZARD_COUNT] = { "register", "flags", "branch" };
+
+bool timing_config::load(const char* path) {
+	ifstream fin(path, ifstream::binary);
+	if (!fin.is_open()) return false;
+
+	string line;
+	while (getline(fin, line)) {
+		istringstream words(line);
+		string key;
+		uint32_t value;
+		if (!(words >> key)) continue;
+		if (!(words >> value)) return false;
+
+		if (key == "depth") depth = value;
+		else if (key == "read") read = value;
+		else if (key == "execute") execute = value;
+		else if (key == "write") write = value;
+		else if (key == "branch") branch = value;
+		else if (key == "forwarding") forwarding = value != 0;
+		else return false;
+	}
+	return valid();
+}
+
+bool timing_config::valid() const {
+	return read >= 1 && read <= execute && execute <= write && write <= depth && branch >= 1 && branch <= depth;
+}
+
+void sim_timed(machine& m, const vector<uint32_t>& program, uint64_t max_cycles, const timing_config& config, timing_stats& stats) {
+	const uint32_t* words = program.data();
+	size_t size = program.size();
+	stats.word_stalls.assign(size, 0);
+
+	// Times are when a word is in the read stage, a result is readable from reg_gap after its word
+	uint64_t reg_gap = config.forwarding ? 1 : config.write - config.read;
+	uint64_t flag_gap = config.execute >= config.branch ? config.execute - config.branch + 1 : 0;
+	uint64_t branch_penalty = config.branch - 1;
+
+	uint64_t reg_ready[16] = {};
+	uint64_t flags_ready = 0;
+	uint64_t t = 0;
+
+	while (m.pc < size && m.cycles < max_cycles) {
+		uint32_t pc = m.pc;
+		uint32_t word = words[pc];
+		uint32_t jmp = word >> 22;
+
+		uint64_t wait[HAZARD_COUNT] = {};
+		if (!jmp && ((word & 0x100) || ((word >> 9) & 3) == 3)) {
+			uint64_t ready = reg_ready[(word >> 4) & 15];
+			if (ready > t) wait[HAZARD_REGISTER] = ready - t;
+		}
+		if (jmp >= 1 && jmp <= 6 && flags_ready > t) wait[HAZARD_FLAGS] = flags_ready - t;
+
+		// the longest wait covers the others
+		uint64_t stall = max(wait[HAZARD_REGISTER], wait[HAZARD_FLAGS]);
+		hazard_type cause = wait[HAZARD_REGISTER] >= wait[HAZARD_FLAGS] ? HAZARD_REGISTER : HAZARD_FLAGS;
+		if (stall) {
+			stats.stalls[cause] += stall;
+			stats.word_stalls[pc] += stall;
+			t += stall;
+		}
+
+		sim_step(m, word);
+		stats.words++;
+
+		if (word & 0x1000) {
+			reg_ready[word & 15] = t + reg_gap;
+			flags_ready = t + flag_gap;
+		}
+		t++;
+
+		if (jmp && m.pc != pc + 1) {
+			stats.stalls[HAZARD_BRANCH] += branch_penalty;
+			stats.word_stalls[pc] += branch_penalty;
+			t += branch_penalty;
+		}
+	}
+
+	// fill before the first word reaches the read stage, drain after the last one
+	stats.cycles = stats.words ? t + config.depth - 1 : 0;
+}
+
+void timing_report(const timing_stats& stats, const vector<int>& source_lines, const char* source, ostream& os) {
+	uint64_t total = 0;
+	for (uint64_t s : stats.stalls) total += s;
+
+	os << "Words: " << stats.words << endl;
+	os << "Cycles: " << stats.cycles << endl;
+	os << "Stalls: " << total;
+	if (stats.cycles) os << " (" << total * 100 / stats.cycles << "%)";
+	os << endl;
+	for (int h = 0; h < HAZARD_COUNT; h++) os << "  " << HAZARD_NAMES[h] << ": " << stats.stalls[h] << endl;
+
+	map<int, uint64_t> by_line;
+	for (size_t i = 0; i < stats.word_stalls.size() && i < source_lines.size(); i++) {
+		if (stats.word_stalls[i]) by_line[source_lines[i]] += stats.word_stalls[i];
+	}
+
+	vector<pair<uint64_t, int>> top;
+	for (auto const& kvp : by_line) top.push_back(make_pair(kvp.second, kvp.first));
+	sort(top.begin(), top.end(), [](const pair<uint64_t, int>& x, const pair<uint64_t, int>& y) {
+		return x.first != y.first ? x.first > y.first : x.second < y.second;
+	});
+	if (top.size() > 10) top.resize(10);
+	if (top.empty()) return;
+
+	map<int, string> text;
+	for (auto const& t : top) text[t.second] = "";
+	read_source_lines(source, text);
+
+	os << endl << "Stalls by source line:" << endl;
+	for (auto const& t : top) os << "  line " << t.second << ": " << t.first << "  " << text[t.second] << endl;
+}
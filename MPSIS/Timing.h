@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "Simulator.h"
+
+/* TIMING CONFIG - "key value" lines, missing keys keep the defaults
+
+depth 4			- pipeline stages, fetch is stage 1
+read 2			- stage that loads RA / RB from RF
+execute 3		- stage where the ALU runs and flags are set
+write 4			- stage that writes RF
+branch 3		- stage where jumps resolve, words fetched behind a taken jump are flushed
+forwarding 0	- 1 feeds ALU results to the next word, no register stalls then
+
+HAZARDS:
+
+* register - word loads a latch from a register an earlier word hasn't written yet
+* flags - conditional jump resolves before the flags of an earlier word are set
+* branch - taken jump, branch - 1 fetched words are thrown away
+
+*/
+
+enum hazard_type { HAZARD_REGISTER, HAZARD_FLAGS, HAZARD_BRANCH, HAZARD_COUNT };
+
+class timing_config {
+public:
+	uint32_t depth = 4;
+	uint32_t read = 2;
+	uint32_t execute = 3;
+	uint32_t write = 4;
+	uint32_t branch = 3;
+	bool forwarding = false;
+
+	// false on unknown keys or stages out of order
+	bool load(const char* path);
+	bool valid() const;
+};
+
+class timing_stats {
+public:
+	uint64_t cycles = 0;
+	uint64_t words = 0;
+	uint64_t stalls[HAZARD_COUNT] = {};
+	std::vector<uint64_t> word_stalls;		// by program position
+};
+
+// sim_run with every word timed through the pipeline
+void sim_timed(machine& m, const std::vector<uint32_t>& program, uint64_t max_cycles, const timing_config& config, timing_stats& stats);
+
+// Totals, stalls by hazard type and the source lines with most stalls
+void timing_report(const timing_stats& stats, const std::vector<int>& source_lines, const char* source, std::ostream& os);
@@ -0,0 +1,217 @@
+#include "Trace.h"
+#include "Queue.h"
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+using namespace std;
+
+const size_t CHUNK = 1 << 20;
+const int HASH_BITS = 14;
+const size_t MIN_MATCH = 4;
+
+static void put_varint(vector<uint8_t>& out, uint64_t v) {
+	while (v >= 0x80) {
+		out.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+static bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+	v = 0;
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+static bool get_varint(istream& in, uint64_t& v) {
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int b = in.get();
+		if (b == EOF) return false;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+// Sequences of varint literal count, literals, varint match length (0 ends), varint distance
+static void lz_pack(const vector<uint8_t>& in, vector<uint8_t>& out, vector<int32_t>& table) {
+	table.assign((size_t)1 << HASH_BITS, -1);
+	out.clear();
+
+	size_t n = in.size();
+	size_t i = 0;
+	size_t literal = 0;
+	while (i + MIN_MATCH <= n) {
+		uint32_t key;
+		memcpy(&key, &in[i], 4);
+		uint32_t h = (key * 2654435761u) >> (32 - HASH_BITS);
+		int32_t candidate = table[h];
+		table[h] = (int32_t)i;
+
+		if (candidate < 0 || memcmp(&in[candidate], &in[i], MIN_MATCH) != 0) {
+			i++;
+			continue;
+		}
+
+		size_t length = MIN_MATCH;
+		while (i + length < n && in[candidate + length] == in[i + length]) length++;
+
+		put_varint(out, i - literal);
+		out.insert(out.end(), in.begin() + literal, in.begin() + i);
+		put_varint(out, length);
+		put_varint(out, i - candidate);
+		i += length;
+		literal = i;
+	}
+
+	put_varint(out, n - literal);
+	out.insert(out.end(), in.begin() + literal, in.end());
+	put_varint(out, 0);
+}
+
+static bool lz_unpack(const vector<uint8_t>& in, vector<uint8_t>& out) {
+	out.clear();
+	const uint8_t* p = in.data();
+	const uint8_t* end = p + in.size();
+
+	while (true) {
+		uint64_t literal, length, distance;
+		if (!get_varint(p, end, literal) || literal > (uint64_t)(end - p)) return false;
+		out.insert(out.end(), p, p + literal);
+		p += literal;
+
+		if (!get_varint(p, end, length)) return false;
+		if (length == 0) return true;
+		if (!get_varint(p, end, distance) || distance == 0 || distance > out.size()) return false;
+		size_t from = out.size() - (size_t)distance;
+		for (uint64_t k = 0; k < length; k++) out.push_back(out[from + k]);
+	}
+}
+
+bool sim_trace(machine& m, const vector<uint32_t>& program, uint64_t max_cycles, const char* path) {
+	ofstream fout(path, ofstream::binary | ofstream::trunc);
+	if (!fout.is_open()) return false;
+
+	vector<uint8_t> head = { 'M', 'P', 'T', 'R' };
+	put_varint(head, m.pc);
+	fout.write((const char*)head.data(), head.size());
+
+	// filled chunks go to the flusher, it hands the buffers back through spare
+	spsc_queue<vector<uint8_t>, 8> full;
+	spsc_queue<vector<uint8_t>, 8> spare;
+	atomic<bool> cancel(false);
+
+	thread flusher([&]() {
+		vector<uint8_t> chunk, packed, size;
+		vector<int32_t> table;
+		while (full.pop_wait(chunk, cancel) && !chunk.empty()) {
+			lz_pack(chunk, packed, table);
+			size.clear();
+			put_varint(size, chunk.size());
+			put_varint(size, packed.size());
+			fout.write((const char*)size.data(), size.size());
+			fout.write((const char*)packed.data(), packed.size());
+			chunk.clear();
+			spare.push(chunk);
+		}
+	});
+
+	const uint32_t* words = program.data();
+	size_t count = program.size();
+	vector<uint8_t> chunk(CHUNK);
+	uint8_t* out = chunk.data();
+	uint8_t* limit = out + CHUNK - 8;
+
+	while (m.pc < count && m.cycles < max_cycles) {
+		uint32_t word = words[m.pc];
+		uint32_t pc = m.pc;
+		sim_step(m, word);
+
+		uint8_t* header = out++;
+		*header = (uint8_t)((m.z << 3) | (m.c << 4));
+		if ((word >> 22) && m.pc != pc + 1) {
+			*header |= 1;
+			uint32_t v = m.pc;
+			for (; v >= 0x80; v >>= 7) *out++ = (uint8_t)(v | 0x80);
+			*out++ = (uint8_t)v;
+		}
+		if (word & 0x1000) {
+			*header |= 2;
+			*out++ = (uint8_t)(((word & 15) << 4) | m.rf[word & 15]);
+		}
+		if (word & 0x800) {
+			*header |= 4;
+			*out++ = (uint8_t)(((word & 3) << 4) | m.out[word & 3]);
+		}
+
+		if (out > limit) {
+			chunk.resize(out - chunk.data());
+			full.push_wait(chunk, cancel);
+			if (!spare.pop(chunk)) chunk = vector<uint8_t>();
+			chunk.resize(CHUNK);
+			out = chunk.data();
+			limit = out + CHUNK - 8;
+		}
+	}
+
+	chunk.resize(out - chunk.data());
+	if (!chunk.empty()) full.push_wait(chunk, cancel);
+	chunk.clear();
+	full.push_wait(chunk, cancel);
+	flusher.join();
+
+	vector<uint8_t> tail;
+	put_varint(tail, 0);
+	fout.write((const char*)tail.data(), tail.size());
+	return fout.good();
+}
+
+bool trace_dump(const char* path, uint32_t lo, uint32_t hi, ostream& os) {
+	ifstream fin(path, ifstream::binary);
+	char magic[4];
+	if (!fin.read(magic, 4) || memcmp(magic, "MPTR", 4) != 0) return false;
+
+	uint64_t pc;
+	if (!get_varint(fin, pc)) return false;
+
+	uint64_t cycle = 0;
+	vector<uint8_t> packed, records;
+	while (true) {
+		uint64_t raw, size;
+		if (!get_varint(fin, raw)) return false;
+		if (raw == 0) return true;
+		if (!get_varint(fin, size)) return false;
+
+		packed.resize((size_t)size);
+		if (!fin.read((char*)packed.data(), size)) return false;
+		if (!lz_unpack(packed, records) || records.size() != raw) return false;
+
+		const uint8_t* p = records.data();
+		const uint8_t* end = p + records.size();
+		while (p < end) {
+			uint8_t header = *p++;
+			uint64_t next = pc + 1;
+			if ((header & 1) && !get_varint(p, end, next)) return false;
+			if (p + ((header >> 1) & 1) + ((header >> 2) & 1) > end) return false;
+			uint8_t reg = (header & 2) ? *p++ : 0;
+			uint8_t out = (header & 4) ? *p++ : 0;
+
+			cycle++;
+			if (pc >= lo && pc <= hi) {
+				os << cycle << ' ' << pc << ':';
+				if (header & 2) os << " r" << (reg >> 4) << '=' << (reg & 15);
+				if (header & 4) os << " out" << (out >> 4) << '=' << (out & 15);
+				os << " z=" << ((header >> 3) & 1) << " c=" << ((header >> 4) & 1);
+				if (header & 1) os << " -> " << next;
+				os << '\n';
+			}
+			pc = next;
+		}
+	}
+}
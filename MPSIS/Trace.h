@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include "Simulator.h"
+
+/* TRACE FILE
+
+"MPTR", varint start pc, then blocks of varint raw size, varint packed size, LZ packed records
+A block with raw size 0 ends the file
+
+RECORD - one per cycle, pc is implied by the previous record
+
+1b header:
+	bit 0 - jump taken, varint destination follows
+	bit 1 - register written, 1b addr << 4 | value follows
+	bit 2 - out written, 1b port << 4 | value follows
+	bit 3 - Z
+	bit 4 - C
+
+*/
+
+// sim_run with every cycle recorded, a background thread packs and writes the records
+// Returns false if the trace file can't be written
+bool sim_trace(machine& m, const std::vector<uint32_t>& program, uint64_t max_cycles, const char* path);
+
+// Prints records with pc in [lo, hi], returns false on a broken file
+bool trace_dump(const char* path, uint32_t lo, uint32_t hi, std::ostream& os);
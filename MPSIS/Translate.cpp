@@ -0,0 +1,131 @@
+#include "Translate.h"
+#include <string>
+
+using namespace std;
+
+static const char* const PRELUDE =
+	"#include <cstdint>\n"
+	"#include <cstdio>\n"
+	"#include <cstdlib>\n"
+	"\n"
+	"// 74181-like ALU, the constant function bits fold away at -O2\n"
+	"static inline void alu(unsigned s, unsigned mode, unsigned p0, unsigned a, unsigned b, uint8_t& f, uint8_t& carry) {\n"
+	"\tunsigned x = (a | (b & ((s & 1) ? 15 : 0)) | (~b & ((s & 2) ? 15 : 0))) & 15;\n"
+	"\tunsigned y = ((a & b & ((s & 8) ? 15 : 0)) | (a & ~b & ((s & 4) ? 15 : 0))) & 15;\n"
+	"\tif (mode) {\n"
+	"\t\tunsigned sum = x + y + p0;\n"
+	"\t\tf = sum & 15;\n"
+	"\t\tcarry = sum >> 4;\n"
+	"\t}\n"
+	"\telse {\n"
+	"\t\tf = x ^ y;\n"
+	"\t\tcarry = 0;\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"int main(int argc, char** argv) {\n"
+	"\tuint8_t r[16] = {};\n"
+	"\tuint8_t ra = 0, rb = 0, z = 0, c = 0;\n"
+	"\tuint8_t out[4] = {};\n"
+	"\tuint8_t in = argc > 1 ? atoi(argv[1]) & 15 : 0;\n"
+	"\tuint64_t max_cycles = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000;\n"
+	"\tuint64_t cycles = 0;\n"
+	"\tuint64_t left = 0;\n"
+	"\tuint32_t pc = 0;\n"
+	"\t(void)in;\n"
+	"\n";
+
+static const char* const EPILOGUE =
+	"done:\n"
+	"\tprintf(\"cycles: %llu\\npc: %u\\nrf:\", (unsigned long long)cycles, pc);\n"
+	"\tfor (int i = 0; i < 16; i++) printf(\" %d\", r[i]);\n"
+	"\tprintf(\"\\nra: %d rb: %d\\nz: %d c: %d\\nout:\", ra, rb, z, c);\n"
+	"\tfor (int i = 0; i < 4; i++) printf(\" %d\", out[i]);\n"
+	"\tprintf(\"\\n\");\n"
+	"\treturn 0;\n"
+	"}\n";
+
+static const char* const CONDITIONS[8] = { "", "!z", "c && !z", "!c", "z", "c", "!c || z", "" };
+
+// One ALU word, same order as sim_step: RF reads, latches, ALU, write-back
+static void emit_word(ostream& os, uint32_t word) {
+	uint32_t rd = (word >> 4) & 15;
+	if (word & 0x100) os << "\tra = r[" << rd << "];\n";
+	switch ((word >> 9) & 3) {
+	case 1: os << "\trb = ((rb << 1) | " << ((word >> 14) & 1) << ") & 15;\n"; break;
+	case 2: os << "\trb = (rb >> 1) | " << (((word >> 15) & 1) << 3) << ";\n"; break;
+	case 3: os << "\trb = r[" << rd << "];\n"; break;
+	}
+
+	if (!(word & 0x1800)) return;
+	os << "\t{\n\t\tuint8_t f, carry;\n";
+	os << "\t\talu(" << ((word >> 18) & 15) << ", " << ((word >> 17) & 1) << ", " << ((word >> 16) & 1) << ", " << ((word & 0x2000) ? "in" : "ra") << ", rb, f, carry);\n";
+	if (word & 0x1000) os << "\t\tr[" << (word & 15) << "] = f;\n\t\tz = f == 0;\n\t\tc = carry;\n";
+	if (word & 0x800) os << "\t\tout[" << (word & 3) << "] = f;\n";
+	os << "\t}\n";
+}
+
+static void emit_goto(ostream& os, uint32_t dest, size_t size) {
+	if (dest < size) os << "goto L" << dest << ";";
+	else os << "{ pc = " << dest << "; goto done; }";
+}
+
+void translate_program(const vector<uint32_t>& program, const char* name, ostream& os) {
+	size_t size = program.size();
+
+	vector<char> entry(size + 1, 0);
+	vector<char> target(size + 1, 0);
+	entry[0] = 1;
+	for (size_t i = 0; i < size; i++) {
+		uint32_t word = program[i];
+		if (!(word >> 22)) continue;
+		uint32_t dest = word & 0xFF;
+		if (dest < size) entry[dest] = target[dest] = 1;
+		entry[i + 1] = 1;
+	}
+
+	vector<size_t> starts;
+	for (size_t i = 0; i < size; i++) if (entry[i]) starts.push_back(i);
+
+	os << "// Translated by MPSIS -aot from " << name << "\n";
+	os << PRELUDE;
+
+	for (size_t b = 0; b < starts.size(); b++) {
+		size_t start = starts[b];
+		size_t end = b + 1 < starts.size() ? starts[b + 1] : size;
+		size_t n = end - start;
+
+		if (target[start]) os << "L" << start << ":\n";
+		os << "\tif (max_cycles - cycles < " << n << ") {\n\t\tleft = max_cycles - cycles;\n\t\tgoto T" << start << ";\n\t}\n";
+		os << "\tcycles += " << n << ";\n";
+
+		for (size_t i = start; i < end; i++) {
+			uint32_t word = program[i];
+			uint32_t jmp = word >> 22;
+			if (!jmp) {
+				emit_word(os, word);
+				continue;
+			}
+			os << "\t";
+			if (jmp != 7) os << "if (" << CONDITIONS[jmp] << ") ";
+			emit_goto(os, word & 0xFF, size);
+			os << "\n";
+		}
+	}
+	os << "\tpc = " << size << ";\n\tgoto done;\n\n";
+
+	// checked copies, left is below the block length so the jump word is never reached
+	for (size_t b = 0; b < starts.size(); b++) {
+		size_t start = starts[b];
+		size_t end = b + 1 < starts.size() ? starts[b + 1] : size;
+
+		os << "T" << start << ":\n";
+		for (size_t i = start; i < end; i++) {
+			os << "\tif (left == " << i - start << ") {\n\t\tpc = " << i << ";\n\t\tgoto done;\n\t}\n";
+			os << "\tcycles++;\n";
+			if (!(program[i] >> 22)) emit_word(os, program[i]);
+		}
+	}
+
+	os << EPILOGUE;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/* TRANSLATED PROGRAM - MPSIS -aot _file out.cpp
+
+Standalone C++, build it with any compiler at -O2 and run it like -run:
+
+	out [DataIn] [max cycles]
+
+A block runs from an entry (start, jump destination, after a conditional jump) to its jump word
+Blocks are straight-line code on uint8_t r[16], jumps are gotos, the cycle limit is checked once per block
+When fewer cycles are left than a block has words, its checked copy stops at the exact word
+
+*/
+
+// Writes the C++ source, name goes into the header comment
+void translate_program(const std::vector<uint32_t>& program, const char* name, std::ostream& os);
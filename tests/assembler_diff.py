@@ -0,0 +1,56 @@
+"""Differential test of the assembler between two MPSIS builds.
+
+Random CRLF sources, some with a line the assembler rejects, are assembled by both builds;
+the output file, the printed word count and the return code have to be byte-identical.
+
+	python tests/assembler_diff.py path/to/old/MPSIS path/to/new/MPSIS [programs]
+"""
+import os
+import subprocess
+import sys
+import tempfile
+
+from sources import random_source, write_source
+
+
+def assemble(mpsis, work):
+	result = subprocess.run([mpsis, 'p.txt'], cwd=work, capture_output=True)
+	output = os.path.join(work, '_p.txt')
+	text = b''
+	if os.path.exists(output):
+		with open(output, 'rb') as f:
+			text = f.read()
+		os.remove(output)
+	return result.returncode, result.stdout, text
+
+
+def main():
+	if len(sys.argv) < 3:
+		print(__doc__)
+		return 2
+	old = os.path.abspath(sys.argv[1])
+	new = os.path.abspath(sys.argv[2])
+	programs = int(sys.argv[3]) if len(sys.argv) > 3 else 1500
+
+	assembled = rejected = mismatches = 0
+	with tempfile.TemporaryDirectory() as work:
+		for seed in range(programs):
+			write_source(os.path.join(work, 'p.txt'), random_source(seed, min_lines=1, max_lines=60, bad_line=0.1))
+
+			before = assemble(old, work)
+			after = assemble(new, work)
+			if before != after:
+				mismatches += 1
+				if mismatches <= 3:
+					print('seed %d:\nold: %s\nnew: %s' % (seed, before, after))
+			elif before[0] == 0:
+				assembled += 1
+			else:
+				rejected += 1
+
+	print('assembled %d, rejected %d, mismatches %d' % (assembled, rejected, mismatches))
+	return 1 if mismatches else 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,130 @@
+"""Checks every operand combination of the encoder against the simulator.
+
+An operand is a constant, DataIn, one of two preloaded registers or the destination register
+itself. add, sub, and, or and xor are checked for all 25 operand pairs, inc and dec for all
+5 operands (135 combinations), plus the mov, not, out, shl and shr forms. Each is assembled
+behind the register loads, run with -run and compared with the result computed here.
+
+	python tests/encoder_semantics.py path/to/MPSIS [values per combination]
+"""
+import itertools
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+BINARY = {
+	'add': lambda x, y: x + y,
+	'sub': lambda x, y: x - y,
+	'and': lambda x, y: x & y,
+	'or': lambda x, y: x | y,
+	'xor': lambda x, y: x ^ y,
+}
+UNARY = {
+	'inc': lambda x: x + 1,
+	'dec': lambda x: x - 1,
+	'mov': lambda x: x,
+	'not': lambda x: ~x,
+}
+KINDS = ['const', 'in', 'a', 'b', 'dest']
+REGS = {'a': 4, 'b': 5, 'dest': 3}
+
+
+def combinations():
+	for name, kinds in itertools.product(BINARY, itertools.product(KINDS, KINDS)):
+		yield name, kinds
+	for name, kind in itertools.product(['inc', 'dec'], KINDS):
+		yield name, (kind,)
+
+
+def other_forms():
+	for name, kind in itertools.product(['mov', 'not', 'out'], KINDS):
+		yield name, (kind,)
+	for name, kind in itertools.product(['shl 0', 'shl 1', 'shr 0', 'shr 1'], ['a', 'dest']):
+		yield name, (kind,)
+
+
+def run_program(mpsis, work, lines, din):
+	with open(os.path.join(work, 'p.txt'), 'w', newline='') as f:
+		f.write(''.join(line + '\r\n' for line in lines))
+	if subprocess.run([mpsis, 'p.txt'], cwd=work, capture_output=True).returncode != 0:
+		return None
+	out = subprocess.run([mpsis, '-run', '_p.txt', str(din), '10000'], cwd=work, capture_output=True, text=True).stdout
+	state = {}
+	for line in out.splitlines():
+		if line.startswith('rf:') or line.startswith('out:'):
+			state[line.split(':')[0]] = [int(x) for x in line.split()[1:]]
+	return state
+
+
+def check(mpsis, work, name, kinds, values):
+	"""Returns the source line and an error, or None when the simulator agrees."""
+	args = []
+	real = []
+	for i, kind in enumerate(kinds):
+		if kind == 'const':
+			args.append('!%d' % values['k%d' % i])
+			real.append(values['k%d' % i])
+		elif kind == 'in':
+			args.append('in')
+			real.append(values['din'])
+		else:
+			args.append(str(REGS[kind]))
+			real.append(values[kind])
+	dest = REGS['dest']
+
+	if name in BINARY:
+		line = '%s %s %s %d' % (name, args[0], args[1], dest)
+		field, index, expected = 'rf', dest, BINARY[name](real[0], real[1]) & 15
+	elif name in UNARY:
+		line = '%s %s %d' % (name, args[0], dest)
+		field, index, expected = 'rf', dest, UNARY[name](real[0]) & 15
+	elif name == 'out':
+		line = 'out %s 2' % args[0]
+		field, index, expected = 'out', 2, real[0]
+	else:
+		shift, bit = name.split()
+		line = '%s %s %s %d' % (shift, args[0], bit, dest)
+		if shift == 'shl':
+			expected = ((real[0] << 1) | int(bit)) & 15
+		else:
+			expected = (real[0] >> 1) | (int(bit) << 3)
+		field, index = 'rf', dest
+
+	loads = ['mov !%d %d' % (values[reg], REGS[reg]) for reg in REGS]
+	state = run_program(mpsis, work, loads + [line], values['din'])
+	if state is None:
+		return line, 'does not assemble'
+	if state[field][index] != expected:
+		return line, '%s[%d] is %d, expected %d' % (field, index, state[field][index], expected)
+	return line, None
+
+
+def main():
+	if len(sys.argv) < 2:
+		print(__doc__)
+		return 2
+	mpsis = os.path.abspath(sys.argv[1])
+	per_form = int(sys.argv[2]) if len(sys.argv) > 2 else 4
+
+	random.seed(30)
+	alu = list(combinations())
+	forms = alu + list(other_forms())
+	checks = failures = 0
+	with tempfile.TemporaryDirectory() as work:
+		for name, kinds in forms:
+			for _ in range(per_form):
+				values = {key: random.randint(0, 15) for key in ['a', 'b', 'dest', 'k0', 'k1', 'din']}
+				line, error = check(mpsis, work, name, kinds, values)
+				checks += 1
+				if error:
+					failures += 1
+					print('%s with %s: %s' % (line, values, error))
+
+	print('combinations %d, other forms %d, checks %d, failures %d' % (len(alu), len(forms) - len(alu), checks, failures))
+	return 1 if failures else 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
@@ -0,0 +1,51 @@
+"""Random MPSIS sources shared by the differential tests."""
+import random
+
+MNEMONICS = ['nop', 'jne', 'jg', 'jl', 'je', 'jge', 'jle', 'jmp', 'mov', 'add', 'sub', 'and', 'or', 'xor',
+	'inc', 'dec', 'shr', 'shl', 'not', 'out', 'lbl']
+BAD_LINES = ['add 0 1 2', 'mov 1 0', 'foo 1', 'shr 1 2 3', 'inc 16 1', 'jmp zz']
+
+
+def operand(kinds='cia'):
+	kind = random.choice(kinds)
+	if kind == 'c':
+		return '!' + str(random.randint(0, 17))
+	if kind == 'i':
+		return 'in'
+	return str(random.choice([1, 2, 3, 5, 9, 15, 17]))
+
+
+def source_line(labels='abc'):
+	name = random.choice(MNEMONICS)
+	if name.startswith('j'):
+		words = [name, random.choice(labels)]
+		if random.random() < 0.3:
+			words.append(random.choice(['3', '12']))
+	elif name == 'lbl':
+		words = [name, random.choice(labels)]
+	elif name in ('inc', 'dec', 'mov', 'not'):
+		words = [name, operand(), operand('a')]
+	elif name in ('shr', 'shl'):
+		words = [name, operand('a'), random.choice(['0', '1']), operand('a')]
+	elif name == 'out':
+		words = [name, operand(), str(random.randint(0, 5))]
+	elif name == 'nop':
+		words = [name]
+	else:
+		words = [name, operand(), operand(), operand('a')]
+	return ' '.join(words)
+
+
+def random_source(seed, min_lines=3, max_lines=40, bad_line=0.0):
+	"""Labels a, b and c, random lines, maybe one line the assembler rejects; repeated labels happen."""
+	random.seed(seed)
+	lines = ['lbl a', 'lbl b', 'lbl c'] + [source_line() for _ in range(random.randint(min_lines, max_lines))]
+	random.shuffle(lines)
+	if random.random() < bad_line:
+		lines.insert(random.randrange(len(lines) + 1), random.choice(BAD_LINES))
+	return lines
+
+
+def write_source(path, lines):
+	with open(path, 'w', newline='') as f:
+		f.write(''.join(line + '\r\n' for line in lines))
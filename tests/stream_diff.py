@@ -0,0 +1,105 @@
+"""Differential test of MPSIS -stream against the normal assembler.
+
+A random source with a repeated label has to fail in -stream with "defined twice". Otherwise
+error reports have to match, and when the normal assembler drops no reloads the -stream text
+has to be byte-identical to it. The -stream bin output has to run like its text output.
+
+	python tests/stream_diff.py path/to/MPSIS [programs]
+"""
+import os
+import subprocess
+import sys
+import tempfile
+
+from sources import BAD_LINES, random_source, write_source
+
+
+def run(args, cwd):
+	return subprocess.run(args, cwd=cwd, capture_output=True, text=True)
+
+
+def read(path):
+	with open(path, 'rb') as f:
+		return f.read()
+
+
+def unique_labels(lines):
+	"""A repeated label definition becomes a nop."""
+	seen = set()
+	result = []
+	for line in lines:
+		if line.startswith('lbl '):
+			if line in seen:
+				line = 'nop'
+			seen.add(line)
+		result.append(line)
+	return result
+
+
+def main():
+	if len(sys.argv) < 2:
+		print(__doc__)
+		return 2
+	mpsis = os.path.abspath(sys.argv[1])
+	programs = int(sys.argv[2]) if len(sys.argv) > 2 else 1500
+
+	identical = dropped = repeated = errors = failures = 0
+	with tempfile.TemporaryDirectory() as work:
+		output = os.path.join(work, '_p.txt')
+
+		def fail(seed, what):
+			nonlocal failures
+			failures += 1
+			if failures <= 3:
+				print('seed %d: %s' % (seed, what))
+
+		for seed in range(programs):
+			lines = random_source(4100 + seed, max_lines=60, bad_line=0.1)
+			if seed % 5 != 0:
+				lines = unique_labels(lines)
+			write_source(os.path.join(work, 'p.txt'), lines)
+
+			streamed = run([mpsis, '-stream', 'p.txt'], work)
+			stream_text = read(output)
+			if lines != unique_labels(lines):
+				repeated += 1
+				# a bad line ahead of the second definition stops the stream first
+				if streamed.returncode == 0 or (b'defined twice' not in stream_text and not set(lines) & set(BAD_LINES)):
+					fail(seed, 'repeated label accepted by -stream')
+				continue
+
+			normal = run([mpsis, 'p.txt'], work)
+			normal_text = read(output)
+			if normal.returncode != 0:
+				errors += 1
+				if (streamed.returncode, stream_text) != (normal.returncode, normal_text):
+					fail(seed, 'error reports differ:\n%s\n%s' % (normal_text, stream_text))
+				continue
+
+			# drop_reloads only runs in the normal assembler
+			if normal.stdout != streamed.stdout:
+				dropped += 1
+			elif normal_text != stream_text:
+				fail(seed, 'text output differs')
+				continue
+			else:
+				identical += 1
+
+			with open(os.path.join(work, 't.txt'), 'wb') as f:
+				f.write(stream_text)
+			run([mpsis, '-stream', 'p.txt', 'bin'], work)
+			os.replace(output, os.path.join(work, 'b.bin'))
+			for din in (0, 3, 15):
+				text_run = run([mpsis, '-run', 't.txt', str(din), '5000'], work).stdout
+				bin_run = run([mpsis, '-run', 'b.bin', str(din), '5000'], work).stdout
+				if text_run != bin_run:
+					fail(seed, 'bin output runs differently with DataIn %d' % din)
+					break
+
+	print('identical %d, reloads dropped %d, repeated labels %d, errors matched %d, failures %d' % (
+		identical, dropped, repeated, errors, failures))
+	return 1 if failures else 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())